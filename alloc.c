@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "fatal.h"
+
+// While tracking, every block starts with a header linking it into a
+// circular list of live blocks
+typedef union BlockHeader
+{
+    struct
+    {
+        union BlockHeader *prev;
+        union BlockHeader *next;
+    } links;
+    max_align_t align; // Keep the caller's part of the block aligned
+} BlockHeader;
+
+static J2RAllocator allocator;
+static int custom_allocator = 0;
+static int tracking = 0;
+static BlockHeader live = {{&live, &live}};
+
+static void *raw_malloc(size_t size)
+{
+    return custom_allocator ? allocator.malloc(size, allocator.user) : malloc(size);
+}
+
+static void *raw_realloc(void *ptr, size_t size)
+{
+    return custom_allocator ? allocator.realloc(ptr, size, allocator.user) : realloc(ptr, size);
+}
+
+static void raw_free(void *ptr)
+{
+    if (custom_allocator)
+        allocator.free(ptr, allocator.user);
+    else
+        free(ptr);
+}
+
+static void link_block(BlockHeader *block)
+{
+    block->links.prev = &live;
+    block->links.next = live.links.next;
+    live.links.next->links.prev = block;
+    live.links.next = block;
+}
+
+static void unlink_block(BlockHeader *block)
+{
+    block->links.prev->links.next = block->links.next;
+    block->links.next->links.prev = block->links.prev;
+}
+
+void *xmalloc(size_t size)
+{
+    if (size == 0)
+        size = 1; // malloc(0) may return NULL
+    if (!tracking)
+    {
+        void *ptr = raw_malloc(size);
+        if (!ptr)
+            fatal_error("Memory allocation failed");
+        return ptr;
+    }
+
+    if (size > SIZE_MAX - sizeof(BlockHeader))
+        fatal_error("Memory allocation failed");
+    BlockHeader *block = raw_malloc(sizeof(BlockHeader) + size);
+    if (!block)
+        fatal_error("Memory allocation failed");
+    link_block(block);
+    return block + 1;
+}
+
+void *xcalloc(size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+        fatal_error("Memory allocation failed");
+    void *ptr = xmalloc(count * size);
+    memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *xrealloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return xmalloc(size);
+    if (size == 0)
+        size = 1;
+    if (!tracking)
+    {
+        ptr = raw_realloc(ptr, size);
+        if (!ptr)
+            fatal_error("Memory allocation failed");
+        return ptr;
+    }
+
+    if (size > SIZE_MAX - sizeof(BlockHeader))
+        fatal_error("Memory allocation failed");
+    // On failure the old block is untouched and still linked
+    BlockHeader *block = raw_realloc((BlockHeader *)ptr - 1, sizeof(BlockHeader) + size);
+    if (!block)
+        fatal_error("Memory allocation failed");
+    block->links.prev->links.next = block;
+    block->links.next->links.prev = block;
+    return block + 1;
+}
+
+char *xstrdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = xmalloc(len);
+    memcpy(copy, str, len);
+    return copy;
+}
+
+void xfree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    if (!tracking)
+    {
+        raw_free(ptr);
+        return;
+    }
+    BlockHeader *block = (BlockHeader *)ptr - 1;
+    unlink_block(block);
+    raw_free(block);
+}
+
+void alloc_begin(const J2RAllocator *custom)
+{
+    custom_allocator = custom != NULL;
+    if (custom)
+        allocator = *custom;
+    tracking = 1;
+}
+
+void alloc_end(void)
+{
+    BlockHeader *block = live.links.next;
+    while (block != &live)
+    {
+        BlockHeader *next = block->links.next;
+        raw_free(block);
+        block = next;
+    }
+    live.links.prev = live.links.next = &live;
+    tracking = 0;
+    custom_allocator = 0;
+}
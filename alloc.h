@@ -0,0 +1,22 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include "json2relcsv.h"
+
+// Allocation for the converter. Every allocation goes through the active
+// allocator, malloc unless a library call installed the caller's, and a
+// failed allocation is a fatal error, so callers never see NULL.
+void *xmalloc(size_t size);
+void *xcalloc(size_t count, size_t size);
+void *xrealloc(void *ptr, size_t size);
+char *xstrdup(const char *str);
+void xfree(void *ptr);
+
+// Route allocations to allocator (NULL for malloc) and track every live
+// block until alloc_end, which frees the blocks still live. That way a
+// conversion abandoned halfway through does not leak.
+void alloc_begin(const J2RAllocator *allocator);
+void alloc_end(void);
+
+#endif // ALLOC_H
@@ -2,34 +2,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ast.h"
+#include "alloc.h"
 
 // Node creation functions
 Node* create_object_node(Pair* pairs) {
-    Node* node = malloc(sizeof(Node));
-    if (!node) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+    Node* node = xmalloc(sizeof(Node));
     node->type = NODE_OBJECT;
     node->value.pairs = pairs;
     return node;
 }
 
 Node* create_array_node(Element* elements) {
-    Node* node = malloc(sizeof(Node));
-    if (!node) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+    Node* node = xmalloc(sizeof(Node));
     node->type = NODE_ARRAY;
     node->value.elements = elements;
     return node;
 }
 
-Node* create_pair_node(char* key, Node* value) {
-    Node* node = malloc(sizeof(Node));
+Node* create_pair_node(Atom key, Node* value) {
+    Node* node = xmalloc(sizeof(Node));
     node->type = NODE_PAIR;
-    Pair* pair = malloc(sizeof(Pair));
+    Pair* pair = xmalloc(sizeof(Pair));
     pair->key = key;
     pair->value = value;
     pair->next = NULL;
@@ -38,44 +31,31 @@ Node* create_pair_node(char* key, Node* value) {
 }
 
 Node* create_string_node(char* str) {
-    Node* node = malloc(sizeof(Node));
-    if (!node) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+    Node* node = xmalloc(sizeof(Node));
     node->type = NODE_STRING;
     node->value.str = str;
     return node;
 }
 
-Node* create_number_node(double num) {
-    Node* node = malloc(sizeof(Node));
-    if (!node) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+// Copies the len bytes of a JSON number literal into the node's own block
+Node* create_number_node(const char* text, size_t len) {
+    Node* node = xmalloc(sizeof(Node) + len + 1);
     node->type = NODE_NUMBER;
-    node->value.num = num;
+    node->value.number = (char*)(node + 1);
+    memcpy(node->value.number, text, len);
+    node->value.number[len] = '\0';
     return node;
 }
 
 Node* create_boolean_node(int boolean) {
-    Node* node = malloc(sizeof(Node));
-    if (!node) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+    Node* node = xmalloc(sizeof(Node));
     node->type = NODE_BOOLEAN;
     node->value.boolean = boolean;
     return node;
 }
 
 Node* create_null_node() {
-    Node* node = malloc(sizeof(Node));
-    if (!node) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+    Node* node = xmalloc(sizeof(Node));
     node->type = NODE_NULL;
     return node;
 }
@@ -93,6 +73,18 @@ Pair* append_pair(Pair* list, Pair* new_pair) {
     return list;
 }
 
+// Reverse a list of pairs in place and return its new head
+Pair* reverse_pairs(Pair* list) {
+    Pair* reversed = NULL;
+    while (list != NULL) {
+        Pair* next = list->next;
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+    return reversed;
+}
+
 Element* append_element(Element* list, Element* new_element) {
     if (list == NULL) {
         return new_element;
@@ -105,80 +97,168 @@ Element* append_element(Element* list, Element* new_element) {
     return list;
 }
 
+// Traversal stack operations
+void stack_reset(TraversalStack* stack, size_t item_size) {
+    stack->item_size = item_size;
+    stack->count = 0;
+}
+
+void* stack_push(TraversalStack* stack) {
+    size_t needed = (stack->count + 1) * stack->item_size;
+    if (needed > stack->capacity) {
+        size_t new_capacity = stack->capacity ? stack->capacity * 2 : 64 * stack->item_size;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        char* items = xrealloc(stack->items, new_capacity);
+        stack->items = items;
+        stack->capacity = new_capacity;
+    }
+    return stack->items + stack->item_size * stack->count++;
+}
+
+void* stack_top(TraversalStack* stack) {
+    if (stack->count == 0) return NULL;
+    return stack->items + stack->item_size * (stack->count - 1);
+}
+
+void stack_pop(TraversalStack* stack) {
+    if (stack->count > 0) stack->count--;
+}
+
+void stack_free(TraversalStack* stack) {
+    xfree(stack->items);
+    stack->items = NULL;
+    stack->capacity = 0;
+    stack->count = 0;
+}
+
 // AST operations
-void print_ast_node(Node* node, int indent) {
-    if (node == NULL) return;
+typedef struct PrintFrame {
+    Node* node;
+    int indent;
+    int started;
+    union {
+        Pair* pair;
+        Element* elem;
+    } next;
+} PrintFrame;
 
+static void print_indent(int indent) {
     for (int i = 0; i < indent; i++) {
         printf("  ");
     }
+}
 
-    switch (node->type) {
-        case NODE_OBJECT:
-            printf("OBJECT\n");
-            Pair* pair = node->value.pairs;
-            while (pair != NULL) {
-                for (int i = 0; i < indent + 1; i++) {
-                    printf("  ");
-                }
-                printf("%s:\n", pair->key);
-                print_ast_node(pair->value, indent + 2);
-                pair = pair->next;
-            }
-            break;
-        case NODE_ARRAY:
-            printf("ARRAY\n");
-            Element* elem = node->value.elements;
-            while (elem != NULL) {
-                print_ast_node(elem->value, indent + 1);
-                elem = elem->next;
+static void print_push(TraversalStack* stack, Node* node, int indent) {
+    if (node == NULL) return;
+    PrintFrame* frame = stack_push(stack);
+    frame->node = node;
+    frame->indent = indent;
+    frame->started = 0;
+}
+
+void print_ast_node(Node* node, int indent) {
+    TraversalStack stack = {0};
+    stack_reset(&stack, sizeof(PrintFrame));
+    print_push(&stack, node, indent);
+
+    PrintFrame* frame;
+    while ((frame = stack_top(&stack)) != NULL) {
+        Node* current = frame->node;
+        int depth = frame->indent;
+
+        if (!frame->started) {
+            frame->started = 1;
+            print_indent(depth);
+
+            switch (current->type) {
+                case NODE_OBJECT:
+                    printf("OBJECT\n");
+                    frame->next.pair = current->value.pairs;
+                    continue;
+                case NODE_ARRAY:
+                    printf("ARRAY\n");
+                    frame->next.elem = current->value.elements;
+                    continue;
+                case NODE_STRING:
+                    printf("STRING: %s\n", current->value.str);
+                    break;
+                case NODE_NUMBER:
+                    printf("NUMBER: %g\n", strtod(current->value.number, NULL));
+                    break;
+                case NODE_BOOLEAN:
+                    printf("BOOLEAN: %s\n", current->value.boolean ? "true" : "false");
+                    break;
+                case NODE_NULL:
+                    printf("NULL\n");
+                    break;
+                default:
+                    printf("UNKNOWN\n");
             }
-            break;
-        case NODE_STRING:
-            printf("STRING: %s\n", node->value.str);
-            break;
-        case NODE_NUMBER:
-            printf("NUMBER: %g\n", node->value.num);
-            break;
-        case NODE_BOOLEAN:
-            printf("BOOLEAN: %s\n", node->value.boolean ? "true" : "false");
-            break;
-        case NODE_NULL:
-            printf("NULL\n");
-            break;
-        default:
-            printf("UNKNOWN\n");
+            stack_pop(&stack);
+            continue;
+        }
+
+        // Visit the next child; the push may move the frame, so advance first
+        if (current->type == NODE_OBJECT && frame->next.pair != NULL) {
+            Pair* pair = frame->next.pair;
+            frame->next.pair = pair->next;
+            print_indent(depth + 1);
+            printf("%s:\n", pair->key);
+            print_push(&stack, pair->value, depth + 2);
+        } else if (current->type == NODE_ARRAY && frame->next.elem != NULL) {
+            Element* elem = frame->next.elem;
+            frame->next.elem = elem->next;
+            print_push(&stack, elem->value, depth + 1);
+        } else {
+            stack_pop(&stack);
+        }
     }
+    stack_free(&stack);
 }
 
 void free_ast_node(Node* node) {
     if (node == NULL) return;
 
-    switch (node->type) {
-        case NODE_OBJECT:
-            Pair* pair = node->value.pairs;
-            while (pair != NULL) {
-                Pair* next = pair->next;
-                free(pair->key);
-                free_ast_node(pair->value);
-                free(pair);
-                pair = next;
-            }
-            break;
-        case NODE_ARRAY:
-            Element* elem = node->value.elements;
-            while (elem != NULL) {
-                Element* next = elem->next;
-                free_ast_node(elem->value);
-                free(elem);
-                elem = next;
-            }
-            break;
-        case NODE_STRING:
-            free(node->value.str);
-            break;
-        default:
-            break;
+    TraversalStack stack = {0};
+    stack_reset(&stack, sizeof(Node*));
+    *(Node**)stack_push(&stack) = node;
+
+    while (stack.count > 0) {
+        Node* current = *(Node**)stack_top(&stack);
+        stack_pop(&stack);
+
+        switch (current->type) {
+            case NODE_OBJECT:
+                Pair* pair = current->value.pairs;
+                while (pair != NULL) {
+                    Pair* next = pair->next;
+                    if (pair->value != NULL) {
+                        *(Node**)stack_push(&stack) = pair->value;
+                    }
+                    xfree(pair);
+                    pair = next;
+                }
+                break;
+            case NODE_ARRAY:
+                Element* elem = current->value.elements;
+                while (elem != NULL) {
+                    Element* next = elem->next;
+                    if (elem->value != NULL) {
+                        *(Node**)stack_push(&stack) = elem->value;
+                    }
+                    xfree(elem);
+                    elem = next;
+                }
+                break;
+            case NODE_STRING:
+                xfree(current->value.str);
+                break;
+            default:
+                break;
+        }
+        xfree(current);
     }
-    free(node);
-} 
\ No newline at end of file
+    stack_free(&stack);
+}
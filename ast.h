@@ -1,6 +1,9 @@
 #ifndef AST_H
 #define AST_H
 
+#include <stddef.h>
+#include "intern.h"
+
 typedef enum {
     NODE_OBJECT,
     NODE_ARRAY,
@@ -16,7 +19,7 @@ typedef struct Pair Pair;
 typedef struct Element Element;
 
 struct Pair {
-    char* key;
+    Atom key;          // Interned, owned by the intern table
     Node* value;
     Pair* next;
 };
@@ -32,23 +35,41 @@ struct Node {
         Pair* pairs;        // For OBJECT
         Element* elements;  // For ARRAY
         char* str;         // For STRING
-        double num;        // For NUMBER
+        char* number;      // For NUMBER, as written; stored after the node
         int boolean;       // For BOOLEAN
     } value;
 };
 
+// Growable stack of fixed-size frames, used by the iterative traversals so
+// deeply nested documents cannot overflow the C stack. The buffer is kept
+// between traversals and only grows.
+typedef struct TraversalStack {
+    char* items;
+    size_t item_size;
+    size_t capacity;    // In bytes
+    int count;
+} TraversalStack;
+
 // Node creation functions
 Node* create_object_node(Pair* pairs);
 Node* create_array_node(Element* elements);
 Node* create_string_node(char* str);
-Node* create_number_node(double num);
+Node* create_number_node(const char* text, size_t len);
 Node* create_boolean_node(int boolean);
 Node* create_null_node();
 
 // Helper functions
 Pair* append_pair(Pair* list, Pair* new_pair);
+Pair* reverse_pairs(Pair* list);
 Element* append_element(Element* list, Element* new_element);
 
+// Traversal stack operations
+void stack_reset(TraversalStack* stack, size_t item_size);
+void* stack_push(TraversalStack* stack);
+void* stack_top(TraversalStack* stack);
+void stack_pop(TraversalStack* stack);
+void stack_free(TraversalStack* stack);
+
 // AST operations
 void print_ast_node(Node* node, int indent);
 void free_ast_node(Node* node);
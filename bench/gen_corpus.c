@@ -0,0 +1,228 @@
+// Deterministic JSON corpus generator for the benchmarks. The same options
+// always produce the same bytes, so results are comparable between commits.
+//
+// Output shape:
+//
+//   {"records": [
+//     {"record_no": 1, <keys scalar fields>,
+//      "level1": {... "level2": {...}},       (--depth levels)
+//      "items": [{"seq": 1, ...}, ...],        (--fanout elements)
+//      "tags": ["...", ...]},                  (--fanout elements)
+//     ...
+//   ]}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef struct Options
+{
+    long records;
+    int keys;       // Scalar fields per record
+    int key_len;    // Length of each field name
+    int depth;      // Levels of nested objects per record
+    int fanout;     // Elements of the items and tags arrays
+    int string_len; // Length of each string value
+    int numeric;    // Percent of fields holding numbers
+    int escapes;    // Percent of strings containing an escape sequence
+    uint64_t seed;
+} Options;
+
+static uint64_t rng_state;
+
+// splitmix64: tiny, fast and identical on every platform
+static uint64_t next_random(void)
+{
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int random_below(int n)
+{
+    return (int)(next_random() % (uint64_t)n);
+}
+
+static void print_usage(const char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] > corpus.json\n", program_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --records N     Number of records (default: 1000)\n");
+    fprintf(stderr, "  --keys N        Scalar fields per record (default: 8)\n");
+    fprintf(stderr, "  --key-len N     Length of field names (default: 8)\n");
+    fprintf(stderr, "  --depth N       Nested objects per record (default: 1)\n");
+    fprintf(stderr, "  --fanout N      Elements per array (default: 4)\n");
+    fprintf(stderr, "  --string-len N  Length of string values (default: 16)\n");
+    fprintf(stderr, "  --numeric P     Percent of fields that are numbers (default: 50)\n");
+    fprintf(stderr, "  --escapes P     Percent of strings with escape sequences (default: 5)\n");
+    fprintf(stderr, "  --seed N        Random seed (default: 1)\n");
+    exit(1);
+}
+
+static void print_key(int index, int key_len)
+{
+    char digits[16];
+    int n = snprintf(digits, sizeof(digits), "%d", index);
+    putchar('"');
+    for (int i = 0; i < key_len - n - 1; i++)
+    {
+        putchar('a' + (index + i) % 26);
+    }
+    printf("_%s\"", digits);
+}
+
+static void print_string(const Options *options)
+{
+    static const char *sequences[] = {"\\\"", "\\\\", "\\n", "\\t", "\\u00e9"};
+    int escape_at = random_below(100) < options->escapes ? random_below(options->string_len) : -1;
+
+    putchar('"');
+    for (int i = 0; i < options->string_len; i++)
+    {
+        if (i == escape_at)
+        {
+            fputs(sequences[random_below(5)], stdout);
+        }
+        else
+        {
+            putchar('a' + random_below(26));
+        }
+    }
+    putchar('"');
+}
+
+static void print_number(void)
+{
+    if (random_below(2))
+        printf("%d", random_below(1000000));
+    else
+        printf("%d.%02d", random_below(10000), random_below(100));
+}
+
+// Whether field index holds numbers. Decided per field, so every record
+// gives a column the same type.
+static int is_numeric_field(int index, const Options *options)
+{
+    return (index * 37 + 11) % 100 < options->numeric;
+}
+
+static void print_fields(const Options *options)
+{
+    for (int k = 0; k < options->keys; k++)
+    {
+        printf(", ");
+        print_key(k, options->key_len);
+        printf(": ");
+        if (is_numeric_field(k, options))
+            print_number();
+        else if (k % 10 == 9)
+            fputs(random_below(2) ? "true" : "false", stdout);
+        else
+            print_string(options);
+    }
+}
+
+static void print_nested(const Options *options, int level)
+{
+    printf("{\"depth\": %d, \"name\": ", level);
+    print_string(options);
+    printf(", \"score\": ");
+    print_number();
+    if (level < options->depth)
+    {
+        printf(", \"level%d\": ", level + 1);
+        print_nested(options, level + 1);
+    }
+    putchar('}');
+}
+
+static void print_record(const Options *options, long id)
+{
+    printf("{\"record_no\": %ld", id);
+    print_fields(options);
+
+    if (options->depth > 0)
+    {
+        printf(", \"level1\": ");
+        print_nested(options, 1);
+    }
+
+    if (options->fanout > 0)
+    {
+        printf(", \"items\": [");
+        for (int i = 0; i < options->fanout; i++)
+        {
+            printf("%s{\"seq\": %d, \"label\": ", i ? ", " : "", i + 1);
+            print_string(options);
+            printf(", \"amount\": ");
+            print_number();
+            putchar('}');
+        }
+        printf("], \"tags\": [");
+        for (int i = 0; i < options->fanout; i++)
+        {
+            if (i)
+                printf(", ");
+            print_string(options);
+        }
+        putchar(']');
+    }
+    putchar('}');
+}
+
+static long parse_number(const char *arg, const char *program_name)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*end != '\0' || value < 0)
+        print_usage(program_name);
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    Options options = {1000, 8, 8, 1, 4, 16, 50, 5, 1};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            print_usage(argv[0]);
+
+        long value = parse_number(argv[i + 1], argv[0]);
+        if (strcmp(argv[i], "--records") == 0)
+            options.records = value;
+        else if (strcmp(argv[i], "--keys") == 0)
+            options.keys = (int)value;
+        else if (strcmp(argv[i], "--key-len") == 0)
+            options.key_len = (int)value;
+        else if (strcmp(argv[i], "--depth") == 0)
+            options.depth = (int)value;
+        else if (strcmp(argv[i], "--fanout") == 0)
+            options.fanout = (int)value;
+        else if (strcmp(argv[i], "--string-len") == 0)
+            options.string_len = (int)value;
+        else if (strcmp(argv[i], "--numeric") == 0)
+            options.numeric = (int)value;
+        else if (strcmp(argv[i], "--escapes") == 0)
+            options.escapes = (int)value;
+        else if (strcmp(argv[i], "--seed") == 0)
+            options.seed = (uint64_t)value;
+        else
+            print_usage(argv[0]);
+        i++;
+    }
+
+    if (options.key_len < 2 || options.string_len < 1 || options.numeric > 100 || options.escapes > 100)
+        print_usage(argv[0]);
+
+    rng_state = options.seed;
+    printf("{\"records\": [");
+    for (long r = 0; r < options.records; r++)
+    {
+        printf(r ? ",\n" : "\n");
+        print_record(&options, r + 1);
+    }
+    printf("\n]}\n");
+    return 0;
+}
@@ -0,0 +1,268 @@
+// Load test for json2relcsv --serve. Concurrent clients send the same
+// document over and over and the latency of every request is recorded, so
+// the percentiles cover the whole run. With -e the requests launch the
+// converter as a process instead, for comparison with what the server
+// replaces.
+//
+// Usage: bench/load_test [-c CLIENTS] [-n REQUESTS] (-s SOCKET | -e BINARY) INPUT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+typedef struct Client
+{
+    pthread_t thread;
+    int index;
+    int requests;
+    double *latencies; // Seconds, one per request
+    int failures;
+} Client;
+
+static const char *socket_path;
+static const char *binary;
+static const char *input_path;
+static char *input;
+static size_t input_len;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// One stream request; the response is read in full and checked for OK
+static int socket_request(void)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), "CONVERT %zu 0 stream\n", input_len);
+    int status = send_all(fd, header, header_len) == 0 && send_all(fd, input, input_len) == 0 ? 0 : -1;
+
+    // Only the status line matters; the tables are read and dropped
+    char buffer[65536];
+    char head[3];
+    size_t head_len = 0;
+    for (;;)
+    {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (ssize_t i = 0; i < n && head_len < sizeof(head); i++)
+            head[head_len++] = buffer[i];
+    }
+    if (head_len < sizeof(head) || memcmp(head, "OK ", 3) != 0)
+        status = -1;
+    close(fd);
+    return status;
+}
+
+// One conversion by a new process, into a directory of the client's own
+static int exec_request(const char *out_dir)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, input_path, O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+
+    char *argv[] = {(char *)binary, "--out-dir", (char *)out_dir, NULL};
+    pid_t pid;
+    int status = posix_spawn(&pid, binary, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (status != 0)
+        return -1;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return 0;
+}
+
+static void *client_main(void *arg)
+{
+    Client *client = arg;
+    char out_dir[64];
+    snprintf(out_dir, sizeof(out_dir), "/tmp/j2r_load_%d_%d", (int)getpid(), client->index);
+    if (binary)
+        mkdir(out_dir, 0755);
+
+    for (int i = 0; i < client->requests; i++)
+    {
+        double start = now();
+        int status = binary ? exec_request(out_dir) : socket_request();
+        client->latencies[i] = now() - start;
+        if (status != 0)
+            client->failures++;
+    }
+
+    if (binary)
+    {
+        char command[128];
+        snprintf(command, sizeof(command), "rm -rf %s", out_dir);
+        if (system(command) != 0)
+            fprintf(stderr, "Could not remove %s\n", out_dir);
+    }
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int count, double p)
+{
+    int index = (int)(p / 100.0 * count + 0.5) - 1;
+    if (index < 0)
+        index = 0;
+    if (index >= count)
+        index = count - 1;
+    return sorted[index];
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-c CLIENTS] [-n REQUESTS] (-s SOCKET | -e BINARY) INPUT\n", program);
+    exit(1);
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = malloc(size > 0 ? size : 1);
+    if (data == NULL || fread(data, 1, size, file) != (size_t)size)
+    {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *len = size;
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    int clients = 8;
+    int requests = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:s:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'e':
+            binary = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || clients < 1 || requests < clients || !socket_path == !binary)
+        usage(argv[0]);
+
+    input_path = argv[optind];
+    input = read_file(input_path, &input_len);
+    if (input == NULL)
+    {
+        fprintf(stderr, "Could not read %s\n", input_path);
+        return 1;
+    }
+
+    double *latencies = malloc(requests * sizeof(double));
+    Client *pool = calloc(clients, sizeof(Client));
+    if (latencies == NULL || pool == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+
+    double start = now();
+    int assigned = 0;
+    for (int i = 0; i < clients; i++)
+    {
+        pool[i].index = i;
+        pool[i].requests = requests / clients + (i < requests % clients);
+        pool[i].latencies = latencies + assigned;
+        assigned += pool[i].requests;
+        pthread_create(&pool[i].thread, NULL, client_main, &pool[i]);
+    }
+    int failures = 0;
+    for (int i = 0; i < clients; i++)
+    {
+        pthread_join(pool[i].thread, NULL);
+        failures += pool[i].failures;
+    }
+    double elapsed = now() - start;
+
+    qsort(latencies, requests, sizeof(double), compare_doubles);
+    printf("%s: %d requests, %d clients, %zu byte document\n", binary ? binary : socket_path, requests, clients,
+           input_len);
+    printf("  throughput %.1f requests/s, %d failed\n", requests / elapsed, failures);
+    printf("  latency ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", percentile(latencies, requests, 50) * 1e3,
+           percentile(latencies, requests, 90) * 1e3, percentile(latencies, requests, 99) * 1e3,
+           latencies[requests - 1] * 1e3);
+
+    free(pool);
+    free(latencies);
+    free(input);
+    return failures ? 1 : 0;
+}
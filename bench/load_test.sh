@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Start json2relcsv --serve, drive it with bench/load_test and report
+# throughput and p50/p90/p99 latency, next to the same requests made by
+# launching the converter once per document.
+#
+# Usage: bench/load_test.sh [-c CLIENTS] [-n REQUESTS] [-w WORKERS] [-r RECORDS]
+
+cd "$(dirname "$0")/.." || exit 1
+
+CLIENTS=8
+REQUESTS=2000
+WORKERS=0
+RECORDS=50
+BINARY=./json2relcsv
+LOAD=bench/load_test
+GEN=bench/gen_corpus
+
+while getopts "c:n:w:r:" opt; do
+    case $opt in
+        c) CLIENTS=$OPTARG ;;
+        n) REQUESTS=$OPTARG ;;
+        w) WORKERS=$OPTARG ;;
+        r) RECORDS=$OPTARG ;;
+        *) echo "Usage: $0 [-c CLIENTS] [-n REQUESTS] [-w WORKERS] [-r RECORDS]" >&2; exit 1 ;;
+    esac
+done
+
+if [ ! -x "$BINARY" ] || [ ! -x "$LOAD" ] || [ ! -x "$GEN" ]; then
+    echo "Build first: make $BINARY $LOAD $GEN" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+SOCKET=$WORK/json2relcsv.sock
+SERVER=
+trap '[ -n "$SERVER" ] && kill "$SERVER" 2>/dev/null; wait; rm -rf "$WORK"' EXIT
+
+# A small document, the size a pipeline sends per call
+$GEN --records "$RECORDS" > "$WORK/input.json"
+
+WORKER_OPTION=
+[ "$WORKERS" -gt 0 ] && WORKER_OPTION="--workers $WORKERS"
+# The converter's row log goes to the server's stderr
+$BINARY --serve "$SOCKET" $WORKER_OPTION > /dev/null 2> "$WORK/server.log" &
+SERVER=$!
+for _ in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+if [ ! -S "$SOCKET" ]; then
+    echo "Server did not start:" >&2
+    cat "$WORK/server.log" >&2
+    exit 1
+fi
+
+$LOAD -c "$CLIENTS" -n "$REQUESTS" -s "$SOCKET" "$WORK/input.json" || exit 1
+echo
+# Fewer requests for the process baseline; each costs a fork and exec
+$LOAD -c "$CLIENTS" -n $((REQUESTS / 10 > CLIENTS ? REQUESTS / 10 : CLIENTS)) -e "$BINARY" "$WORK/input.json"
@@ -0,0 +1,284 @@
+// Component microbenchmarks. Each stage of the converter is driven on its
+// own from an in-memory copy of the input, so a regression can be pinned to
+// the stage that caused it. Results are printed as JSON for diffing between
+// commits.
+//
+// Bison actions always build the AST, so the parse stage covers lexing,
+// parsing and AST construction together; lex on its own and AST teardown
+// are reported separately.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "ast.h"
+#include "schema.h"
+#include "parser.h"
+#include "parser.tab.h"
+#include "tape.h"
+#include "stats.h"
+#include "fatal.h"
+
+typedef struct Result
+{
+    const char *name;
+    const char *unit; // What items counts
+    double best;      // Seconds
+    double total;
+    long long items;  // Per iteration
+} Result;
+
+enum
+{
+    STAGE_LEX,
+    STAGE_PARSE,
+    STAGE_SCHEMA,
+    STAGE_POPULATE,
+    STAGE_WRITE,
+    STAGE_COUNT
+};
+
+static Result results[STAGE_COUNT] = {
+    {"lex", "tokens", 0, 0, 0},
+    {"parse", "entries", 0, 0, 0},
+    {"schema", "tables", 0, 0, 0},
+    {"populate", "rows", 0, 0, 0},
+    {"write", "rows", 0, 0, 0},
+};
+
+static int saved_stdout = -1;
+static int saved_stderr = -1;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void record(int stage, double seconds, long long items)
+{
+    Result *result = &results[stage];
+    if (result->total == 0 || seconds < result->best)
+        result->best = seconds;
+    result->total += seconds;
+    result->items = items;
+}
+
+// The scanner and the schema code log every token and row; send that to
+// /dev/null while timing, as a benchmark run of the converter would
+static void silence(void)
+{
+    fflush(stdout);
+    fflush(stderr);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0)
+        return;
+    saved_stdout = dup(STDOUT_FILENO);
+    saved_stderr = dup(STDERR_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+}
+
+static void restore(void)
+{
+    fflush(stdout);
+    fflush(stderr);
+    if (saved_stdout >= 0)
+    {
+        dup2(saved_stdout, STDOUT_FILENO);
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stdout);
+        close(saved_stderr);
+        saved_stdout = saved_stderr = -1;
+    }
+}
+
+// Errors are printed while output is silenced; repeat the message
+static void exit_on_fatal_error(void)
+{
+    if (saved_stderr >= 0)
+    {
+        restore();
+        fprintf(stderr, "%s\n", fatal_error_message());
+    }
+    exit(1);
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *buffer = malloc(size > 0 ? size : 1);
+    if (!buffer)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    if (fread(buffer, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "Error: Could not read %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+    *len = size;
+    return buffer;
+}
+
+static long long count_rows(Schema *schema)
+{
+    long long rows = 0;
+    for (Table *table = schema->tables; table != NULL; table = table->next)
+    {
+        rows += table->row_count;
+    }
+    return rows;
+}
+
+static Schema *generate(Tape *tape)
+{
+    Schema *schema = create_schema();
+    generate_schema_from_tape(tape, schema);
+    build_table_plans(schema);
+    return schema;
+}
+
+static void print_usage(const char *program_name)
+{
+    fprintf(stderr, "Usage: %s [-n ITERATIONS] [-o RESULTS.json] input.json\n", program_name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 5;
+    const char *output = NULL;
+    const char *input_path = NULL;
+
+    set_fatal_handler(exit_on_fatal_error);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (input_path == NULL && argv[i][0] != '-')
+            input_path = argv[i];
+        else
+            print_usage(argv[0]);
+    }
+    if (input_path == NULL || iterations < 1)
+        print_usage(argv[0]);
+
+    size_t len;
+    char *input = read_file(input_path, &len);
+    Tape *tape = NULL;
+    Schema *schema = NULL;
+
+    silence();
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        // Scanner alone
+        YY_BUFFER_STATE buffer = yy_scan_bytes(input, (int)len);
+        long long tokens = 0;
+        double start = now();
+        int token;
+        while ((token = yylex()) != 0)
+        {
+            if (token == STRING || token == NUMBER)
+                free(yylval.str);
+            tokens++;
+        }
+        record(STAGE_LEX, now() - start, tokens);
+        yy_delete_buffer(buffer);
+
+        // Scanner and parser, building the tape
+        free_tape(tape);
+        buffer = yy_scan_bytes(input, (int)len);
+        start = now();
+        tape = parse_document();
+        record(STAGE_PARSE, now() - start, (long long)tape->count);
+        yy_delete_buffer(buffer);
+    }
+
+    if (tape == NULL)
+    {
+        restore();
+        fprintf(stderr, "Error: %s holds no document\n", input_path);
+        return 1;
+    }
+
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        double start = now();
+        Schema *generated = generate(tape);
+        record(STAGE_SCHEMA, now() - start, generated->table_count);
+        free_schema(generated);
+    }
+
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        free_schema(schema);
+        schema = generate(tape);
+        double start = now();
+        populate_data_from_tape(tape, schema);
+        record(STAGE_POPULATE, now() - start, count_rows(schema));
+    }
+
+    FILE *null_file = fopen("/dev/null", "w");
+    for (int iter = 0; null_file != NULL && iter < iterations; iter++)
+    {
+        double start = now();
+        for (Table *table = schema->tables; table != NULL; table = table->next)
+        {
+            write_table_to_csv(table, null_file);
+        }
+        fflush(null_file);
+        record(STAGE_WRITE, now() - start, count_rows(schema));
+    }
+    if (null_file != NULL)
+        fclose(null_file);
+    free_schema(schema);
+    free_tape(tape);
+    restore();
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "Error: Could not open file %s for writing\n", output);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"input\": \"%s\",\n  \"bytes\": %zu,\n  \"iterations\": %d,\n  \"stages\": {",
+            input_path, len, iterations);
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        Result *result = &results[i];
+        double mean = result->total / iterations;
+        fprintf(out, "%s\n    \"%s\": {\"best_ms\": %.3f, \"mean_ms\": %.3f, \"mb_per_s\": %.2f, "
+                     "\"%s\": %lld, \"%s_per_s\": %.0f}",
+                i ? "," : "", result->name, result->best * 1e3, mean * 1e3,
+                result->best > 0 ? len / 1048576.0 / result->best : 0.0,
+                result->unit, result->items, result->unit,
+                result->best > 0 ? result->items / result->best : 0.0);
+    }
+    fprintf(out, "\n  }\n}\n");
+    if (out != stdout)
+        fclose(out);
+
+    free(input);
+    free_table_name_cache();
+    intern_free_all();
+    return 0;
+}
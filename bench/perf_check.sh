@@ -0,0 +1,120 @@
+#!/bin/bash
+#
+# Run the benchmark corpus and compare throughput and peak memory against
+# bench/baseline.json. Exits non-zero when any benchmark regressed.
+#
+# A throughput drop counts as a regression when it is larger than the
+# tolerance and the two 95% confidence intervals do not overlap, so noise
+# on a busy machine does not fail the check.
+#
+# Usage: bench/perf_check.sh [-t PERCENT] [-m PERCENT] [-r RUNS] [-u]
+#   -t  allowed throughput drop (default: $PERF_TOLERANCE or 10)
+#   -m  allowed peak RSS growth (default: $MEM_TOLERANCE or 10)
+#   -r  runs per benchmark (default: $PERF_RUNS or 5)
+#   -u  write the results as the new baseline instead of comparing
+
+cd "$(dirname "$0")/.." || exit 1
+
+BASELINE=bench/baseline.json
+TOLERANCE=${PERF_TOLERANCE:-10}
+MEM_TOLERANCE=${MEM_TOLERANCE:-10}
+RUNS=${PERF_RUNS:-5}
+UPDATE=0
+
+while getopts "t:m:r:u" opt; do
+    case $opt in
+        t) TOLERANCE=$OPTARG ;;
+        m) MEM_TOLERANCE=$OPTARG ;;
+        r) RUNS=$OPTARG ;;
+        u) UPDATE=1 ;;
+        *) echo "Usage: $0 [-t PERCENT] [-m PERCENT] [-r RUNS] [-u]" >&2; exit 1 ;;
+    esac
+done
+
+CURRENT=$(mktemp)
+trap 'rm -f "$CURRENT"' EXIT
+
+bench/run_bench.sh -r "$RUNS" -j "$CURRENT" || exit 1
+echo
+
+if [ $UPDATE -eq 1 ]; then
+    cp "$CURRENT" "$BASELINE"
+    echo "Baseline written to $BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "No baseline at $BASELINE; create one with: make perf-baseline" >&2
+    exit 1
+fi
+
+# Both files hold one benchmark per line: "name": {"key": value, ...}
+awk -v tol="$TOLERANCE" -v mem_tol="$MEM_TOLERANCE" '
+function parse(line, file,    name, fields, n, i, kv) {
+    if (!match(line, /"[a-z_0-9]+": \{/))
+        return
+    name = substr(line, RSTART + 1, RLENGTH - 5)
+    gsub(/.*\{|\}.*/, "", line)
+    n = split(line, fields, ", ")
+    for (i = 1; i <= n; i++) {
+        split(fields[i], kv, ": ")
+        gsub(/"/, "", kv[1])
+        value[file, name, kv[1]] = kv[2]
+    }
+    if (file == "current")
+        names[++count] = name
+    seen[file, name] = 1
+}
+function throughput(name, metric, label,    base, cur, base_ci, cur_ci, change, status) {
+    base = value["baseline", name, metric]
+    cur = value["current", name, metric]
+    base_ci = value["baseline", name, metric "_ci"]
+    cur_ci = value["current", name, metric "_ci"]
+    change = base > 0 ? 100 * (cur - base) / base : 0
+    status = "ok"
+    if (change < -tol && cur + cur_ci < base - base_ci) {
+        status = "REGRESSION"
+        failed++
+    } else if (change > tol && cur - cur_ci > base + base_ci) {
+        status = "faster"
+    }
+    printf "%-9s %-12s %14.2f %14.2f %+8.1f%%  %s\n", name, label, base, cur, change, status
+}
+function memory(name,    base, cur, change, status) {
+    base = value["baseline", name, "peak_rss_kb"]
+    cur = value["current", name, "peak_rss_kb"]
+    change = base > 0 ? 100 * (cur - base) / base : 0
+    status = "ok"
+    if (change > mem_tol) {
+        status = "REGRESSION"
+        failed++
+    }
+    printf "%-9s %-12s %14d %14d %+8.1f%%  %s\n", name, "peak RSS KB", base, cur, change, status
+}
+FNR == 1 { file = (FILENAME == ARGV[1]) ? "baseline" : "current" }
+{ parse($0, file) }
+END {
+    printf "%-9s %-12s %14s %14s %9s  %s\n", "bench", "metric", "baseline", "current", "change", "status"
+    for (i = 1; i <= count; i++) {
+        name = names[i]
+        if (!seen["baseline", name]) {
+            printf "%-9s %-12s %14s %14s %9s  %s\n", name, "-", "-", "-", "-", "new, not in baseline"
+            continue
+        }
+        if (value["baseline", name, "bytes"] != value["current", name, "bytes"]) {
+            printf "%-9s input changed (%d -> %d bytes); re-baseline\n", name,
+                value["baseline", name, "bytes"], value["current", name, "bytes"]
+            failed++
+            continue
+        }
+        throughput(name, "mb_per_s", "MB/s")
+        throughput(name, "rows_per_s", "rows/s")
+        memory(name)
+    }
+    printf "\n"
+    if (failed) {
+        printf "perf-check: %d regression(s) beyond %s%% throughput / %s%% memory tolerance\n", failed, tol, mem_tol
+        exit 1
+    }
+    printf "perf-check: no regressions beyond %s%% throughput / %s%% memory tolerance\n", tol, mem_tol
+}' "$BASELINE" "$CURRENT"
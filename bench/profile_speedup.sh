@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# Run the benchmark corpus with several builds of json2relcsv and report the
+# throughput of each relative to the first one.
+#
+# Usage: bench/profile_speedup.sh [-r RUNS] BASELINE_BINARY BINARY...
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=5
+while getopts "r:" opt; do
+    case $opt in
+        r) RUNS=$OPTARG ;;
+        *) echo "Usage: $0 [-r RUNS] BASELINE_BINARY BINARY..." >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 [-r RUNS] BASELINE_BINARY BINARY..." >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+n=0
+for binary in "$@"; do
+    echo "== $binary"
+    bench/run_bench.sh -r "$RUNS" -b "$binary" -j "$WORK/$n.json" || exit 1
+    echo
+    n=$((n + 1))
+done
+
+# Result files hold one benchmark per line: "name": {"mb_per_s": value, ...}
+awk -v count=$n '
+BEGIN { file = -1 }
+FNR == 1 { file++ }
+match($0, /"[a-z_0-9]+": \{/) {
+    name = substr($0, RSTART + 1, RLENGTH - 5)
+    if (file == 0)
+        names[++benches] = name
+    line = $0
+    sub(/.*"mb_per_s": /, "", line)
+    sub(/,.*/, "", line)
+    mbs[file, name] = line
+}
+END {
+    printf "%-9s", "bench"
+    for (f = 1; f < count; f++)
+        printf " %10s", "build " f
+    printf "\n"
+    for (i = 1; i <= benches; i++) {
+        name = names[i]
+        printf "%-9s", name
+        for (f = 1; f < count; f++)
+            printf " %9.2fx", (mbs[0, name] > 0 ? mbs[f, name] / mbs[0, name] : 0)
+        printf "\n"
+    }
+}' $(for i in $(seq 0 $((n - 1))); do echo "$WORK/$i.json"; done)
+
+i=0
+for binary in "$@"; do
+    [ $i -gt 0 ] && echo "build $i: $binary"
+    i=$((i + 1))
+done
+exit 0
@@ -0,0 +1,122 @@
+#!/bin/bash
+#
+# Run json2relcsv over the generated benchmark corpus and report throughput
+# in MB/s and rows/s as the mean of several runs with a 95% confidence
+# interval.
+#
+# Usage: bench/run_bench.sh [-r RUNS] [-j RESULTS.json] [-b BINARY] [BENCH...]
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=5
+RESULTS=""
+BINARY=./json2relcsv
+GEN=bench/gen_corpus
+CORPUS=bench/corpus
+
+# name and generator options of each benchmark
+PROFILES="
+flat     --records 20000 --keys 8 --depth 0 --fanout 0
+wide     --records 2000 --keys 128 --key-len 16 --depth 0 --fanout 0
+nested   --records 5000 --depth 6
+arrays   --records 2000 --fanout 32
+strings  --records 5000 --keys 4 --string-len 256 --escapes 50 --numeric 0
+numeric  --records 10000 --keys 16 --numeric 100
+"
+
+while getopts "r:j:b:" opt; do
+    case $opt in
+        r) RUNS=$OPTARG ;;
+        j) RESULTS=$OPTARG ;;
+        b) BINARY=$OPTARG ;;
+        *) echo "Usage: $0 [-r RUNS] [-j RESULTS.json] [-b BINARY] [BENCH...]" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+SELECTED="$*"
+
+if [ ! -x "$BINARY" ] || [ ! -x "$GEN" ]; then
+    echo "Build first: make $BINARY $GEN" >&2
+    exit 1
+fi
+if [ "$RUNS" -lt 2 ]; then
+    echo "Need at least 2 runs for a confidence interval" >&2
+    exit 1
+fi
+
+mkdir -p "$CORPUS"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# mean, half-width of the 95% confidence interval (Student's t)
+summarize() {
+    awk '
+    BEGIN {
+        split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086", t, " ")
+    }
+    { x[NR] = $1; sum += $1 }
+    END {
+        mean = sum / NR
+        for (i = 1; i <= NR; i++) ss += (x[i] - mean) ^ 2
+        sd = sqrt(ss / (NR - 1))
+        df = NR - 1
+        printf "%.3f %.3f\n", mean, (df <= 20 ? t[df] : 1.960) * sd / sqrt(NR)
+    }'
+}
+
+[ -n "$RESULTS" ] && echo "{" > "$RESULTS"
+first=1
+
+printf "%-9s %8s %9s %20s %22s %10s\n" "bench" "MB" "rows" "MB/s" "rows/s" "peak RSS"
+while read -r name options; do
+    [ -z "$name" ] && continue
+    if [ -n "$SELECTED" ] && ! echo " $SELECTED " | grep -q " $name "; then
+        continue
+    fi
+
+    # The corpus is deterministic, so it only needs generating once
+    input="$CORPUS/$name.json"
+    if [ ! -s "$input" ] || [ "$GEN" -nt "$input" ]; then
+        # shellcheck disable=SC2086
+        "$GEN" $options > "$input"
+    fi
+    bytes=$(stat -c %s "$input")
+
+    : > "$OUT/mbs"
+    : > "$OUT/rps"
+    rss=0
+    rows=0
+    for run in $(seq "$RUNS"); do
+        rm -rf "$OUT/csv"
+        start=$(date +%s%N)
+        "$BINARY" --out-dir "$OUT/csv" --stats-json "$OUT/stats.json" < "$input" > /dev/null 2>&1 || {
+            echo "$name: json2relcsv failed" >&2
+            exit 1
+        }
+        end=$(date +%s%N)
+
+        rows=$(awk '/"tables"/ { t = 1; next } t && /: [0-9]+/ { gsub(/,/, ""); n += $2 } END { print n + 0 }' "$OUT/stats.json")
+        run_rss=$(awk -F': ' '/"peak_rss_kb"/ { gsub(/,/, "", $2); print $2 }' "$OUT/stats.json")
+        [ "$run_rss" -gt "$rss" ] && rss=$run_rss
+        awk -v b="$bytes" -v r="$rows" -v ns=$((end - start)) 'BEGIN {
+            s = ns / 1e9
+            printf "%f\n", b / 1048576 / s >> "'"$OUT/mbs"'"
+            printf "%f\n", r / s >> "'"$OUT/rps"'"
+        }'
+    done
+
+    read -r mbs mbs_ci < <(summarize < "$OUT/mbs")
+    read -r rps rps_ci < <(summarize < "$OUT/rps")
+    printf "%-9s %8.2f %9d %11.2f ± %6.2f %13.0f ± %6.0f %7d KB\n" \
+        "$name" "$(awk -v b="$bytes" 'BEGIN { print b / 1048576 }')" "$rows" "$mbs" "$mbs_ci" "$rps" "$rps_ci" "$rss"
+
+    if [ -n "$RESULTS" ]; then
+        [ $first -eq 0 ] && echo "," >> "$RESULTS"
+        printf '  "%s": {"bytes": %d, "rows": %d, "runs": %d, "mb_per_s": %s, "mb_per_s_ci": %s, "rows_per_s": %s, "rows_per_s_ci": %s, "peak_rss_kb": %d}' \
+            "$name" "$bytes" "$rows" "$RUNS" "$mbs" "$mbs_ci" "$rps" "$rps_ci" "$rss" >> "$RESULTS"
+        first=0
+    fi
+done <<< "$PROFILES"
+
+[ -n "$RESULTS" ] && printf '\n}\n' >> "$RESULTS"
+exit 0
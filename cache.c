@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "schema.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+// XXH64, reading the input as little-endian words on little-endian hosts.
+// Keys only need to be stable on the machine that owns the cache.
+uint64_t hash64(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        const unsigned char *limit = end - 32;
+        do
+        {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end)
+    {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+int open_cache(OutputCache *cache, const char *dir)
+{
+    cache->dir = dir;
+    cache->key[0] = '\0';
+    cache->hits = 0;
+    cache->misses = 0;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Error: Could not create cache directory %s\n", dir);
+        return -1;
+    }
+    return 0;
+}
+
+// The key covers the input bytes and every option that changes the output.
+// Two seeds give a 128-bit key, so a collision is not a practical concern.
+void cache_key(OutputCache *cache, const char *input, size_t len, const char *options)
+{
+    uint64_t seed = hash64(options, strlen(options), 0);
+    uint64_t h1 = hash64(input, len, seed);
+    uint64_t h2 = hash64(input, len, seed ^ PRIME64_3);
+    snprintf(cache->key, sizeof(cache->key), "%016llx%016llx",
+             (unsigned long long)h1, (unsigned long long)h2);
+}
+
+static int copy_file(const char *from, const char *to)
+{
+    int in = open(from, O_RDONLY);
+    if (in < 0)
+        return -1;
+
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return -1;
+    }
+
+    char buffer[65536];
+    ssize_t n;
+    int result = 0;
+    while ((n = read(in, buffer, sizeof(buffer))) > 0)
+    {
+        char *p = buffer;
+        while (n > 0)
+        {
+            ssize_t written = write(out, p, n);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                result = -1;
+                break;
+            }
+            p += written;
+            n -= written;
+        }
+        if (result != 0)
+            break;
+    }
+    if (n < 0)
+        result = -1;
+
+    close(in);
+    if (close(out) != 0)
+        result = -1;
+    return result;
+}
+
+// Place a cached file at path. Hard links cost nothing; fall back to a copy
+// when the cache and the output directory are on different file systems.
+static int link_or_copy(const char *from, const char *to)
+{
+    // Never write through an existing file, which may itself be a link
+    // into the cache
+    unlink(to);
+    if (link(from, to) == 0)
+        return 0;
+    return copy_file(from, to);
+}
+
+// Link the files of a cached conversion into out_dir. Returns 1 on a hit,
+// 0 when there is no usable entry.
+int cache_lookup(OutputCache *cache, const char *out_dir)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s/MANIFEST", cache->dir, cache->key);
+
+    FILE *manifest = fopen(path, "r");
+    if (manifest == NULL)
+    {
+        cache->misses++;
+        return 0;
+    }
+
+    char name[1024];
+    int files = 0;
+    int ok = 1;
+    while (ok && fgets(name, sizeof(name), manifest) != NULL)
+    {
+        name[strcspn(name, "\n")] = '\0';
+        if (name[0] == '\0' || strchr(name, '/') != NULL)
+        {
+            fprintf(stderr, "Warning: Ignoring corrupt cache entry %s\n", cache->key);
+            ok = 0;
+            break;
+        }
+
+        char from[4096];
+        char to[4096];
+        snprintf(from, sizeof(from), "%s/%s/%s", cache->dir, cache->key, name);
+        snprintf(to, sizeof(to), "%s/%s", out_dir, name);
+        if (link_or_copy(from, to) != 0)
+        {
+            fprintf(stderr, "Warning: Could not restore %s from cache\n", from);
+            ok = 0;
+        }
+        files++;
+    }
+    fclose(manifest);
+
+    if (!ok || files == 0)
+    {
+        cache->misses++;
+        return 0;
+    }
+
+    cache->hits++;
+    return 1;
+}
+
+// Copy the CSV files just written for schema, and their schema sidecar,
+// into a new cache entry. The
+// entry is assembled under a temporary name and renamed into place, so a
+// reader never sees a partial entry.
+int cache_store(OutputCache *cache, Schema *schema, const char *out_dir)
+{
+    char tmp_dir[2048];
+    char entry_dir[2048];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/%s.tmp.%ld", cache->dir, cache->key, (long)getpid());
+    snprintf(entry_dir, sizeof(entry_dir), "%s/%s", cache->dir, cache->key);
+
+    if (mkdir(tmp_dir, 0755) != 0)
+    {
+        fprintf(stderr, "Warning: Could not create cache entry %s\n", tmp_dir);
+        return -1;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/MANIFEST", tmp_dir);
+    FILE *manifest = fopen(path, "w");
+    int ok = manifest != NULL;
+
+    for (Table *table = schema->tables; ok && table != NULL; table = table->next)
+    {
+        char from[4096];
+        char to[4096];
+        snprintf(from, sizeof(from), "%s/%s.csv", out_dir, table->name);
+        snprintf(to, sizeof(to), "%s/%s.csv", tmp_dir, table->name);
+
+        // Copy rather than link, so the entry cannot change with the output
+        if (copy_file(from, to) != 0)
+        {
+            ok = 0;
+            break;
+        }
+        chmod(to, 0444);
+        fprintf(manifest, "%s.csv\n", table->name);
+    }
+    if (ok)
+    {
+        char from[4096];
+        char to[4096];
+        snprintf(from, sizeof(from), "%s/%s", out_dir, SCHEMA_SIDECAR);
+        snprintf(to, sizeof(to), "%s/%s", tmp_dir, SCHEMA_SIDECAR);
+        ok = copy_file(from, to) == 0;
+        if (ok)
+        {
+            chmod(to, 0444);
+            fprintf(manifest, "%s\n", SCHEMA_SIDECAR);
+        }
+    }
+
+    if (manifest != NULL && fclose(manifest) != 0)
+        ok = 0;
+
+    // Another run may have stored the same entry first; either copy is fine
+    if (ok && rename(tmp_dir, entry_dir) == 0)
+        return 0;
+
+    if (!ok)
+        fprintf(stderr, "Warning: Could not store conversion in cache %s\n", cache->dir);
+
+    for (Table *table = schema->tables; table != NULL; table = table->next)
+    {
+        snprintf(path, sizeof(path), "%s/%s.csv", tmp_dir, table->name);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/%s", tmp_dir, SCHEMA_SIDECAR);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/MANIFEST", tmp_dir);
+    unlink(path);
+    rmdir(tmp_dir);
+    return ok ? 0 : -1;
+}
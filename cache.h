@@ -0,0 +1,35 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Schema;
+
+// A content-addressed store of converted outputs. Each entry is a directory
+// named after the hash of the input bytes and the conversion options, holding
+// the CSV files of one conversion and a MANIFEST listing them.
+#define CACHE_KEY_SIZE 33 // 128-bit key as hex, plus NUL
+
+// Part of every key. Bump it whenever a change alters the CSV output, so
+// entries written by older builds are not reused.
+#define CACHE_FORMAT_VERSION 7
+
+typedef struct OutputCache
+{
+    const char *dir;
+    char key[CACHE_KEY_SIZE];
+    int hits;
+    int misses;
+} OutputCache;
+
+// XXH64 of len bytes of data
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+
+// Cache operations
+int open_cache(OutputCache *cache, const char *dir);
+void cache_key(OutputCache *cache, const char *input, size_t len, const char *options);
+int cache_lookup(OutputCache *cache, const char *out_dir);
+int cache_store(OutputCache *cache, struct Schema *schema, const char *out_dir);
+
+#endif // CACHE_H
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "fatal.h"
+
+static FatalHandler fatal_handler = NULL;
+static char message[512];
+
+FatalHandler set_fatal_handler(FatalHandler handler)
+{
+    FatalHandler previous = fatal_handler;
+    fatal_handler = handler;
+    return previous;
+}
+
+void fatal_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    fprintf(stderr, "%s\n", message);
+
+    if (fatal_handler)
+        fatal_handler();
+    // Only reachable when nothing installed a handler, which is a bug
+    abort();
+}
+
+const char *fatal_error_message(void)
+{
+    return message;
+}
@@ -0,0 +1,15 @@
+#ifndef FATAL_H
+#define FATAL_H
+
+// Unrecoverable errors in the converter: bad input, exhausted memory. The
+// message goes to stderr and is kept for fatal_error_message(), then the
+// installed handler takes over. The library unwinds to the entry point of
+// the current call, the command-line tool exits. A handler must not return.
+typedef void (*FatalHandler)(void);
+
+// Install handler and return the previous one
+FatalHandler set_fatal_handler(FatalHandler handler);
+void fatal_error(const char *format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+const char *fatal_error_message(void);
+
+#endif // FATAL_H
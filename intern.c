@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "intern.h"
+#include "alloc.h"
+
+#define INTERN_INITIAL_CAPACITY 256
+#define INTERN_BLOCK_SIZE 65536
+
+typedef struct AtomEntry AtomEntry;
+typedef struct AtomBlock AtomBlock;
+
+struct AtomEntry
+{
+    unsigned int hash;
+    int id;
+    size_t len;
+    char str[];
+};
+
+// Entries are carved out of large blocks so interning a new key does not
+// cost one malloc per string
+struct AtomBlock
+{
+    AtomBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static AtomEntry **slots = NULL;
+static int capacity = 0;
+static int count = 0;
+static AtomBlock *blocks = NULL;
+
+static unsigned int hash_bytes(const char *str, size_t len)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void *block_alloc(size_t size)
+{
+    // Keep entries aligned for the hash/id header
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (blocks == NULL || blocks->used + size > blocks->size)
+    {
+        size_t block_size = size > INTERN_BLOCK_SIZE ? size : INTERN_BLOCK_SIZE;
+        AtomBlock *block = xmalloc(sizeof(AtomBlock) + block_size);
+        block->used = 0;
+        block->size = block_size;
+        block->next = blocks;
+        blocks = block;
+    }
+
+    void *ptr = blocks->data + blocks->used;
+    blocks->used += size;
+    return ptr;
+}
+
+static void grow_table(void)
+{
+    int new_capacity = capacity ? capacity * 2 : INTERN_INITIAL_CAPACITY;
+    AtomEntry **new_slots = xcalloc(new_capacity, sizeof(AtomEntry *));
+
+    for (int i = 0; i < capacity; i++)
+    {
+        AtomEntry *entry = slots[i];
+        if (entry == NULL)
+            continue;
+
+        int index = entry->hash & (new_capacity - 1);
+        while (new_slots[index] != NULL)
+        {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        new_slots[index] = entry;
+    }
+
+    xfree(slots);
+    slots = new_slots;
+    capacity = new_capacity;
+}
+
+static AtomEntry *entry_of(Atom atom)
+{
+    return (AtomEntry *)(atom - offsetof(AtomEntry, str));
+}
+
+// Find the slot holding str, or the empty slot where it belongs
+static int find_slot(const char *str, size_t len, unsigned int hash)
+{
+    int index = hash & (capacity - 1);
+    while (slots[index] != NULL)
+    {
+        AtomEntry *entry = slots[index];
+        if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0)
+        {
+            return index;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+    return index;
+}
+
+Atom intern_string_len(const char *str, size_t len)
+{
+    if (str == NULL)
+        return NULL;
+
+    // Keep the load factor at or below one half
+    if ((count + 1) * 2 > capacity)
+    {
+        grow_table();
+    }
+
+    unsigned int hash = hash_bytes(str, len);
+    int index = find_slot(str, len, hash);
+    if (slots[index] != NULL)
+    {
+        return slots[index]->str;
+    }
+
+    AtomEntry *entry = block_alloc(sizeof(AtomEntry) + len + 1);
+    entry->hash = hash;
+    entry->id = count;
+    entry->len = len;
+    memcpy(entry->str, str, len);
+    entry->str[len] = '\0';
+
+    slots[index] = entry;
+    count++;
+    return entry->str;
+}
+
+Atom intern_string(const char *str)
+{
+    if (str == NULL)
+        return NULL;
+    return intern_string_len(str, strlen(str));
+}
+
+// Look up an existing atom without adding a new one
+Atom intern_lookup(const char *str)
+{
+    if (str == NULL || capacity == 0)
+        return NULL;
+
+    size_t len = strlen(str);
+    int index = find_slot(str, len, hash_bytes(str, len));
+    return slots[index] ? slots[index]->str : NULL;
+}
+
+int atom_id(Atom atom)
+{
+    if (atom == NULL)
+        return -1;
+    return entry_of(atom)->id;
+}
+
+int intern_count(void)
+{
+    return count;
+}
+
+void intern_free_all(void)
+{
+    AtomBlock *block = blocks;
+    while (block != NULL)
+    {
+        AtomBlock *next = block->next;
+        xfree(block);
+        block = next;
+    }
+    blocks = NULL;
+
+    xfree(slots);
+    slots = NULL;
+    capacity = 0;
+    count = 0;
+}
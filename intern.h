@@ -0,0 +1,18 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+// An interned string. Every distinct string is stored exactly once, so two
+// atoms are equal if and only if their pointers are equal.
+typedef const char *Atom;
+
+// Intern operations
+Atom intern_string(const char *str);
+Atom intern_string_len(const char *str, size_t len);
+Atom intern_lookup(const char *str);
+int atom_id(Atom atom);
+int intern_count(void);
+void intern_free_all(void);
+
+#endif // INTERN_H
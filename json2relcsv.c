@@ -0,0 +1,272 @@
+// libjson2relcsv entry points. Each conversion runs the same pipeline as
+// the command-line tool (parse, tape, schema, write) under a global lock,
+// with the caller's allocator installed and every allocation tracked. A
+// fatal error anywhere in the pipeline unwinds here with longjmp, and the
+// tracked blocks are released, so a failed conversion leaks nothing.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "json2relcsv.h"
+#include "schema.h"
+#include "parser.h"
+#include "intern.h"
+#include "tape.h"
+#include "stats.h"
+#include "alloc.h"
+#include "fatal.h"
+#include "sink.h"
+
+struct J2RContext
+{
+    J2RAllocator allocator;
+    int custom_allocator;
+    int max_depth;
+    char error[512];
+};
+
+// The scanner, parser and interned strings are process-wide
+static pthread_mutex_t convert_lock = PTHREAD_MUTEX_INITIALIZER;
+static jmp_buf *unwind_target;
+
+static void unwind(void)
+{
+    longjmp(*unwind_target, 1);
+}
+
+J2RContext *j2r_context_create(const J2RAllocator *allocator)
+{
+    if (allocator && (!allocator->malloc || !allocator->realloc || !allocator->free))
+        return NULL;
+
+    J2RContext *ctx = allocator ? allocator->malloc(sizeof(J2RContext), allocator->user)
+                                : malloc(sizeof(J2RContext));
+    if (ctx == NULL)
+        return NULL;
+
+    memset(ctx, 0, sizeof(J2RContext));
+    if (allocator)
+    {
+        ctx->allocator = *allocator;
+        ctx->custom_allocator = 1;
+    }
+    ctx->max_depth = DEFAULT_MAX_DEPTH;
+    return ctx;
+}
+
+void j2r_context_free(J2RContext *ctx)
+{
+    if (ctx == NULL)
+        return;
+    if (ctx->custom_allocator)
+        ctx->allocator.free(ctx, ctx->allocator.user);
+    else
+        free(ctx);
+}
+
+int j2r_set_max_depth(J2RContext *ctx, int depth)
+{
+    if (ctx == NULL || depth < 1)
+        return -1;
+    ctx->max_depth = depth;
+    return 0;
+}
+
+const char *j2r_error(const J2RContext *ctx)
+{
+    return ctx ? ctx->error : "NULL context";
+}
+
+// Read fd to the end into a tracked buffer
+static char *read_fd(int fd, size_t *len)
+{
+    size_t capacity = 65536;
+    size_t size = 0;
+    char *buffer = xmalloc(capacity);
+
+    for (;;)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            buffer = xrealloc(buffer, capacity);
+        }
+        ssize_t n = read(fd, buffer + size, capacity - size);
+        if (n == 0)
+            break;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fatal_error("Error: Could not read input: %s", strerror(errno));
+        }
+        size += n;
+    }
+
+    *len = size;
+    return buffer;
+}
+
+static void convert(const char *data, size_t len, Sink *sink)
+{
+    if (len > INT_MAX)
+        fatal_error("Error: Input too large");
+
+    YY_BUFFER_STATE buffer = yy_scan_bytes(data, (int)len);
+    stats_begin(PHASE_PARSE);
+    Tape *tape = parse_document();
+    stats_end(PHASE_PARSE);
+    yy_delete_buffer(buffer);
+
+    Schema *schema = convert_tape(tape);
+    if (schema != NULL && write_schema_to_sink(schema, sink) != 0)
+        fatal_error("Error: Could not write the tables");
+    free_schema(schema);
+    free_tape(tape);
+}
+
+// Run one conversion from data, or from fd when data is NULL
+static int run(J2RContext *ctx, const char *data, size_t len, int fd, Sink *sink)
+{
+    if (ctx == NULL)
+        return -1;
+    if (sink == NULL)
+    {
+        snprintf(ctx->error, sizeof(ctx->error), "Error: No output sink");
+        return -1;
+    }
+
+    pthread_mutex_lock(&convert_lock);
+    jmp_buf target;
+    jmp_buf *previous_target = unwind_target;
+    FatalHandler previous_handler = set_fatal_handler(unwind);
+    unwind_target = &target;
+    alloc_begin(ctx->custom_allocator ? &ctx->allocator : NULL);
+    int previous_depth = json_max_depth;
+    json_max_depth = ctx->max_depth;
+    memset(&run_stats, 0, sizeof(run_stats));
+
+    int status = 0;
+    if (setjmp(target) == 0)
+    {
+        if (data == NULL)
+            data = read_fd(fd, &len);
+        convert(data, len, sink);
+        ctx->error[0] = '\0';
+    }
+    else
+    {
+        status = -1;
+        snprintf(ctx->error, sizeof(ctx->error), "%s", fatal_error_message());
+    }
+
+    // Whatever the conversion left behind belongs to the tracked allocator
+    reset_scanner();
+    free_table_name_cache();
+    intern_free_all();
+    free_stats();
+    alloc_end();
+    json_max_depth = previous_depth;
+
+    unwind_target = previous_target;
+    set_fatal_handler(previous_handler);
+    pthread_mutex_unlock(&convert_lock);
+    return status;
+}
+
+static const J2RAllocator *allocator_of(const J2RContext *ctx)
+{
+    return ctx->custom_allocator ? &ctx->allocator : NULL;
+}
+
+J2RSink *j2r_sink_dir(J2RContext *ctx, const char *dir)
+{
+    return ctx && dir ? create_dir_sink(allocator_of(ctx), dir) : NULL;
+}
+
+J2RSink *j2r_sink_fd(J2RContext *ctx, int fd)
+{
+    return ctx ? create_fd_sink(allocator_of(ctx), fd) : NULL;
+}
+
+J2RSink *j2r_sink_memory(J2RContext *ctx)
+{
+    return ctx ? create_memory_sink(allocator_of(ctx)) : NULL;
+}
+
+J2RSink *j2r_sink_callback(J2RContext *ctx, J2RSinkCallback callback, void *user)
+{
+    return ctx && callback ? create_callback_sink(allocator_of(ctx), callback, user) : NULL;
+}
+
+void j2r_sink_free(J2RSink *sink)
+{
+    free_sink(sink);
+}
+
+void j2r_sink_reset(J2RSink *sink)
+{
+    reset_memory_sink(sink);
+}
+
+int j2r_sink_table_count(const J2RSink *sink)
+{
+    return memory_sink_table_count(sink);
+}
+
+const char *j2r_sink_table(const J2RSink *sink, int index, const char **data, size_t *len)
+{
+    return memory_sink_table(sink, index, data, len);
+}
+
+int j2r_convert_buffer_to(J2RContext *ctx, const char *data, size_t len, J2RSink *sink)
+{
+    if (data == NULL && len > 0)
+    {
+        if (ctx)
+            snprintf(ctx->error, sizeof(ctx->error), "Error: NULL input");
+        return -1;
+    }
+    return run(ctx, data ? data : "", len, -1, sink);
+}
+
+int j2r_convert_fd_to(J2RContext *ctx, int fd, J2RSink *sink)
+{
+    return run(ctx, NULL, 0, fd, sink);
+}
+
+// The directory variants make a sink for the one call
+static int convert_to_dir(J2RContext *ctx, const char *data, size_t len, int from_fd, int fd,
+                          const char *out_dir)
+{
+    if (ctx == NULL)
+        return -1;
+    if (out_dir == NULL)
+    {
+        snprintf(ctx->error, sizeof(ctx->error), "Error: No output directory");
+        return -1;
+    }
+    Sink *sink = create_dir_sink(allocator_of(ctx), out_dir);
+    if (sink == NULL)
+    {
+        snprintf(ctx->error, sizeof(ctx->error), "Memory allocation failed");
+        return -1;
+    }
+    int status = from_fd ? j2r_convert_fd_to(ctx, fd, sink) : j2r_convert_buffer_to(ctx, data, len, sink);
+    free_sink(sink);
+    return status;
+}
+
+int j2r_convert_buffer(J2RContext *ctx, const char *data, size_t len, const char *out_dir)
+{
+    return convert_to_dir(ctx, data, len, 0, -1, out_dir);
+}
+
+int j2r_convert_fd(J2RContext *ctx, int fd, const char *out_dir)
+{
+    return convert_to_dir(ctx, NULL, 0, 1, fd, out_dir);
+}
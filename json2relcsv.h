@@ -0,0 +1,87 @@
+#ifndef JSON2RELCSV_H
+#define JSON2RELCSV_H
+
+// libjson2relcsv: convert a JSON document into relational CSV tables
+// without starting a process.
+//
+//   J2RContext *ctx = j2r_context_create(NULL);
+//   if (j2r_convert_buffer(ctx, json, len, "out") != 0)
+//       fprintf(stderr, "%s\n", j2r_error(ctx));
+//   j2r_context_free(ctx);
+//
+// Functions return 0 on success and -1 on failure; the library never exits
+// the process. The scanner and parser keep global state, so conversions
+// from different threads are serialized rather than run in parallel.
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define J2R_API __attribute__((visibility("default")))
+#else
+#define J2R_API
+#endif
+
+// Memory functions for everything a conversion allocates. user is passed
+// back on every call. Nothing allocated during a conversion outlives it.
+typedef struct J2RAllocator
+{
+    void *(*malloc)(size_t size, void *user);
+    void *(*realloc)(void *ptr, size_t size, void *user);
+    void (*free)(void *ptr, void *user);
+    void *user;
+} J2RAllocator;
+
+typedef struct J2RContext J2RContext;
+
+// Create a context; allocator may be NULL for malloc, realloc and free
+J2R_API J2RContext *j2r_context_create(const J2RAllocator *allocator);
+J2R_API void j2r_context_free(J2RContext *ctx);
+
+// Reject documents nested deeper than depth levels (default 100000)
+J2R_API int j2r_set_max_depth(J2RContext *ctx, int depth);
+
+// Convert len bytes of JSON, writing one <table>.csv per table to out_dir,
+// which must exist
+J2R_API int j2r_convert_buffer(J2RContext *ctx, const char *data, size_t len, const char *out_dir);
+
+// Same, reading the JSON from fd until end of file
+J2R_API int j2r_convert_fd(J2RContext *ctx, int fd, const char *out_dir);
+
+// Where the CSV of each table goes. A sink can be reused for several
+// conversions; it must be freed before the context that created it.
+typedef struct J2RSink J2RSink;
+
+// Called with consecutive chunks of the CSV of table, then once with data
+// NULL and len 0 when the table is complete. Return nonzero to fail the
+// conversion.
+typedef int (*J2RSinkCallback)(const char *table, const char *data, size_t len, void *user);
+
+// One <table>.csv file per table in dir, which must exist
+J2R_API J2RSink *j2r_sink_dir(J2RContext *ctx, const char *dir);
+// All tables written to fd one after another, each introduced by a line
+// "==> <table>.csv <==" and followed by an empty line
+J2R_API J2RSink *j2r_sink_fd(J2RContext *ctx, int fd);
+// Tables kept in memory, read back with j2r_sink_table. Tables of later
+// conversions are added after those of earlier ones.
+J2R_API J2RSink *j2r_sink_memory(J2RContext *ctx);
+J2R_API J2RSink *j2r_sink_callback(J2RContext *ctx, J2RSinkCallback callback, void *user);
+J2R_API void j2r_sink_free(J2RSink *sink);
+// Drop the tables of a memory sink but keep its buffer for the next ones
+J2R_API void j2r_sink_reset(J2RSink *sink);
+
+// Tables of a memory sink, in the order they were written. Returns the
+// table name and sets data and len to its CSV, or returns NULL when index
+// is out of range or the sink is not a memory sink. The data stays valid
+// until the sink is used again or freed.
+J2R_API int j2r_sink_table_count(const J2RSink *sink);
+J2R_API const char *j2r_sink_table(const J2RSink *sink, int index, const char **data, size_t *len);
+
+// Convert into a sink instead of a directory. After a failed conversion
+// the sink may hold the tables written before the failure.
+J2R_API int j2r_convert_buffer_to(J2RContext *ctx, const char *data, size_t len, J2RSink *sink);
+J2R_API int j2r_convert_fd_to(J2RContext *ctx, int fd, J2RSink *sink);
+
+// Message of the last failed call on ctx, or "" after a success
+J2R_API const char *j2r_error(const J2RContext *ctx);
+
+#endif // JSON2RELCSV_H
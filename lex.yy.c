@@ -362,7 +362,6 @@ extern char *yytext;
 static yy_state_type yy_get_previous_state ( void );
 static yy_state_type yy_try_NUL_trans ( yy_state_type current_state  );
 static int yy_get_next_buffer ( void );
-static void yynoreturn yy_fatal_error ( const char* msg  );
 
 /* Done after the current pattern has been matched and before the
  * corresponding action - sets up yytext.
@@ -503,9 +502,13 @@ char *yytext;
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include "parser.h"
 #include "common.h"
 #include "parser.tab.h"
+#include "stats.h"
+#include "alloc.h"
+#include "fatal.h"
 
 
 void yyerror(const char* s);
@@ -519,11 +522,44 @@ void print_next_chars(const char* text, int len) {
     printf("\n");
 }
 
+int scanner_trace = 0;
+
+/* Each token on stdout while scanner_trace is set */
+#define TRACE(...) do { if (scanner_trace) printf(__VA_ARGS__); } while (0)
+
 /* Local column counter */
 static int current_column = 1;
-#line 524 "lex.yy.c"
+
+/* Nesting depth of the current position, bounded by json_max_depth */
+static int current_depth = 0;
+
+static void enter_nesting(void) {
+    if (++current_depth > json_max_depth) {
+        fatal_error("Error: Document nested deeper than %d levels at line %d, column %d\n"
+                    "Use --max-depth to raise the limit",
+                    json_max_depth, yylineno, current_column);
+    }
+}
+
+/* Flex's own errors (buffer allocation, jam) are fatal like any other, so
+   nothing in the library can end the process (the Makefile checks the
+   shared library) */
+#define YY_FATAL_ERROR(msg) fatal_error("%s", msg)
+
+/* Input comes from yyin unless a ScannerReader is installed */
+static int scanner_input(char* buf, int max_size);
+#define YY_INPUT(buf, result, max_size) result = scanner_input(buf, max_size);
+
+/* Every matched byte, whitespace included, is a byte of input read */
+#define YY_USER_ACTION run_stats.bytes_read += yyleng;
+
+static int token(int type) {
+    run_stats.tokens++;
+    return type;
+}
+#line 560 "lex.yy.c"
 #define YY_NO_INPUT 1
-#line 526 "lex.yy.c"
+#line 562 "lex.yy.c"
 
 #define INITIAL 0
 
@@ -741,10 +777,10 @@ YY_DECL
 		}
 
 	{
-#line 31 "scanner.l"
+#line 69 "scanner.l"
 
 
-#line 747 "lex.yy.c"
+#line 783 "lex.yy.c"
 
 	while ( /*CONSTCOND*/1 )		/* loops until end-of-file is reached */
 		{
@@ -814,124 +850,125 @@ do_action:	/* This label is used only to access EOF actions. */
 
 case 1:
 YY_RULE_SETUP
-#line 33 "scanner.l"
+#line 71 "scanner.l"
 { /* Skip UTF-8 BOM */ }
 	YY_BREAK
 case 2:
 YY_RULE_SETUP
-#line 34 "scanner.l"
+#line 72 "scanner.l"
 { current_column += yyleng; }  /* Skip spaces and tabs */
 	YY_BREAK
 case 3:
 /* rule 3 can match eol */
 YY_RULE_SETUP
-#line 35 "scanner.l"
+#line 73 "scanner.l"
 { current_column = 1; }        /* Handle Windows line endings */
 	YY_BREAK
 case 4:
 /* rule 4 can match eol */
 YY_RULE_SETUP
-#line 36 "scanner.l"
+#line 74 "scanner.l"
 { current_column = 1; }        /* Handle Unix line endings */
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 37 "scanner.l"
+#line 75 "scanner.l"
 { }                           /* Skip bare carriage returns */
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 38 "scanner.l"
-{ current_column++; return LBRACE; }
+#line 76 "scanner.l"
+{ enter_nesting(); current_column++; return token(LBRACE); }
 	YY_BREAK
 case 7:
 YY_RULE_SETUP
-#line 39 "scanner.l"
-{ current_column++; return RBRACE; }
+#line 77 "scanner.l"
+{ current_depth--; current_column++; return token(RBRACE); }
 	YY_BREAK
 case 8:
 YY_RULE_SETUP
-#line 40 "scanner.l"
-{ current_column++; return LBRACKET; }
+#line 78 "scanner.l"
+{ enter_nesting(); current_column++; return token(LBRACKET); }
 	YY_BREAK
 case 9:
 YY_RULE_SETUP
-#line 41 "scanner.l"
-{ current_column++; return RBRACKET; }
+#line 79 "scanner.l"
+{ current_depth--; current_column++; return token(RBRACKET); }
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 42 "scanner.l"
-{ current_column++; return COLON; }
+#line 80 "scanner.l"
+{ current_column++; return token(COLON); }
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 43 "scanner.l"
-{ current_column++; return COMMA; }
+#line 81 "scanner.l"
+{ current_column++; return token(COMMA); }
 	YY_BREAK
 case 12:
 /* rule 12 can match eol */
 YY_RULE_SETUP
-#line 46 "scanner.l"
+#line 84 "scanner.l"
 {
     /* String literal */
-    char* str = malloc(yyleng - 1);
+    char* str = xmalloc(yyleng - 1);
     strncpy(str, yytext + 1, yyleng - 2);
     str[yyleng - 2] = '\0';
     yylval.str = str;
-    printf("Found string '%s' at line %d, column %d\n", str, yylineno, current_column);
+    TRACE("Found string '%s' at line %d, column %d\n", str, yylineno, current_column);
     current_column += yyleng;
-    return STRING;
+    return token(STRING);
 }
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
-#line 57 "scanner.l"
+#line 95 "scanner.l"
 {
-    /* Number literal */
-    yylval.num = atof(yytext);
-    printf("Found number %f at line %d, column %d\n", yylval.num, yylineno, current_column);
+    /* Number literal, kept as written; its value is parsed from the text */
+    char* text = xmalloc(yyleng + 1);
+    memcpy(text, yytext, yyleng + 1);
+    yylval.str = text;
+    TRACE("Found number %f at line %d, column %d\n", atof(text), yylineno, current_column);
     current_column += yyleng;
-    return NUMBER;
+    return token(NUMBER);
 }
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
-#line 65 "scanner.l"
-{ printf("Found 'true' at line %d, column %d\n", yylineno, current_column); current_column += yyleng; return TRUE; }
+#line 105 "scanner.l"
+{ TRACE("Found 'true' at line %d, column %d\n", yylineno, current_column); current_column += yyleng; return token(TRUE); }
 	YY_BREAK
 case 15:
 YY_RULE_SETUP
-#line 66 "scanner.l"
-{ printf("Found 'false' at line %d, column %d\n", yylineno, current_column); current_column += yyleng; return FALSE; }
+#line 106 "scanner.l"
+{ TRACE("Found 'false' at line %d, column %d\n", yylineno, current_column); current_column += yyleng; return token(FALSE); }
 	YY_BREAK
 case 16:
 YY_RULE_SETUP
-#line 67 "scanner.l"
-{ printf("Found 'null' at line %d, column %d\n", yylineno, current_column); current_column += yyleng; return NULL_VAL; }
+#line 107 "scanner.l"
+{ TRACE("Found 'null' at line %d, column %d\n", yylineno, current_column); current_column += yyleng; return token(NULL_VAL); }
 	YY_BREAK
 case 17:
 YY_RULE_SETUP
-#line 69 "scanner.l"
+#line 109 "scanner.l"
 {
     unsigned char c = (unsigned char)yytext[0];
     if (isprint(c)) {
-        fprintf(stderr, "Error: Unexpected character '%c' (ASCII %d) at line %d, column %d\n", 
-                c, (int)c, yylineno, current_column);
-    } else {
-        fprintf(stderr, "Error: Unexpected non-printable character (ASCII %d) at line %d, column %d\n", 
-                (int)c, yylineno, current_column);
+        fatal_error("Error: Unexpected character '%c' (ASCII %d) at line %d, column %d\n"
+                    "Expected one of: {, }, [, ], :, ,, \", number, true, false, null",
+                    c, (int)c, yylineno, current_column);
     }
-    fprintf(stderr, "Expected one of: {, }, [, ], :, ,, \", number, true, false, null\n");
-    exit(1);
+    fatal_error("Error: Unexpected non-printable character (ASCII %d) at line %d, column %d\n"
+                "Expected one of: {, }, [, ], :, ,, \", number, true, false, null",
+                (int)c, yylineno, current_column);
 }
 	YY_BREAK
 case 18:
 YY_RULE_SETUP
-#line 82 "scanner.l"
+#line 121 "scanner.l"
 ECHO;
 	YY_BREAK
-#line 934 "lex.yy.c"
+#line 971 "lex.yy.c"
 case YY_STATE_EOF(INITIAL):
 	yyterminate();
 
@@ -1703,11 +1740,6 @@ YY_BUFFER_STATE yy_scan_bytes  (const char * yybytes, int  _yybytes_len )
 #define YY_EXIT_FAILURE 2
 #endif
 
-static void yynoreturn yy_fatal_error (const char* msg )
-{
-			fprintf( stderr, "%s\n", msg );
-	exit( YY_EXIT_FAILURE );
-}
 
 /* Redefine yyless() so it works in section 3 code. */
 
@@ -1884,30 +1916,55 @@ static int yy_flex_strlen (const char * s )
 }
 #endif
 
-void *yyalloc (yy_size_t  size )
-{
-			return malloc(size);
+
+#define YYTABLES_NAME "yytables"
+
+#line 121 "scanner.l"
+
+
+/* Scanner buffers come from the converter's allocator */
+void* yyalloc(yy_size_t size) {
+    return xmalloc(size);
 }
 
-void *yyrealloc  (void * ptr, yy_size_t  size )
-{
-		
-	/* The cast to (char *) in the following accommodates both
-	 * implementations that use char* generic pointers, and those
-	 * that use void* generic pointers.  It works with the latter
-	 * because both ANSI C and C++ allow castless assignment from
-	 * any pointer type to void*, and deal with argument conversions
-	 * as though doing an assignment.
-	 */
-	return realloc(ptr, size);
+void* yyrealloc(void* ptr, yy_size_t size) {
+    return xrealloc(ptr, size);
 }
 
-void yyfree (void * ptr )
-{
-			free( (char *) ptr );	/* see yyrealloc() for (char *) cast */
+void yyfree(void* ptr) {
+    xfree(ptr);
 }
 
-#define YYTABLES_NAME "yytables"
+static ScannerReader scanner_reader = NULL;
+static void* scanner_reader_data = NULL;
 
-#line 82 "scanner.l"
+void set_scanner_reader(ScannerReader reader, void* data) {
+    scanner_reader = reader;
+    scanner_reader_data = data;
+}
+
+static int scanner_input(char* buf, int max_size) {
+    if (scanner_reader) {
+        return (int)scanner_reader(buf, max_size, scanner_reader_data);
+    }
+    size_t n;
+    errno = 0;
+    while ((n = fread(buf, 1, max_size, yyin)) == 0 && ferror(yyin)) {
+        if (errno != EINTR) {
+            fatal_error("Error: Could not read input: %s", strerror(errno));
+        }
+        errno = 0;
+        clearerr(yyin);
+    }
+    return (int)n;
+}
+
+/* Forget the input and position, so the next parse starts clean even if
+   the last one was abandoned halfway */
+void reset_scanner(void) {
+    yylex_destroy();
+    set_scanner_reader(NULL, NULL);
+    current_column = 1;
+    current_depth = 0;
+}
 
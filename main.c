@@ -1,29 +1,143 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include "ast.h"
 #include "schema.h"
 #include "parser.h"
+#include "intern.h"
+#include "tape.h"
+#include "cache.h"
+#include "stats.h"
+#include "perf.h"
+#include "fatal.h"
+#include "server.h"
+#include "pipeline.h"
+#include "parallel.h"
 
-extern Node *root;
-extern int yyparse(void);
 extern int yycolumn;
 
 void print_usage(const char *program_name)
 {
-    fprintf(stderr, "Usage: %s < input.json [--print-ast] [--out-dir DIR]\n", program_name);
+    fprintf(stderr, "Usage: %s < input.json [--print-ast] [--trace] [--out-dir DIR] [--max-depth N] [--save-ast FILE] [--cache-dir DIR] [--stats] [--stats-json FILE] [--perf-counters] [--no-pipeline] [--threads N]\n", program_name);
+    fprintf(stderr, "       %s --load-ast FILE [--print-ast] [--out-dir DIR] [--cache-dir DIR]\n", program_name);
+    fprintf(stderr, "       %s --serve SOCKET [--workers N] [--max-request BYTES]\n", program_name);
+    fprintf(stderr, "       %s --connect SOCKET < input.json [--out-dir DIR | --stream] [--max-depth N]\n", program_name);
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  --print-ast    Print the Abstract Syntax Tree to stdout\n");
+    fprintf(stderr, "  --print-ast    Print the parsed document as a tree to stdout\n");
+    fprintf(stderr, "  --trace        Print every token the scanner finds to stdout\n");
     fprintf(stderr, "  --out-dir DIR  Specify output directory for CSV files (default: current directory)\n");
+    fprintf(stderr, "  --max-depth N  Reject documents nested deeper than N levels (default: %d)\n", DEFAULT_MAX_DEPTH);
+    fprintf(stderr, "  --save-ast FILE  Save the parsed document as a snapshot for --load-ast\n");
+    fprintf(stderr, "  --load-ast FILE  Convert a saved snapshot instead of parsing stdin\n");
+    fprintf(stderr, "  --cache-dir DIR  Reuse the CSV files of an earlier run on the same input\n");
+    fprintf(stderr, "  --stats        Print time per phase, bytes, tokens, tape entries, rows and peak RSS to stderr\n");
+    fprintf(stderr, "  --stats-json FILE  Write the same statistics as JSON to FILE (- for stdout)\n");
+    fprintf(stderr, "  --perf-counters  Count cycles, instructions, cache and branch misses per phase (Linux)\n");
+    fprintf(stderr, "  --no-pipeline  Read, convert and write one after another instead of on overlapping threads\n");
+    fprintf(stderr, "  --threads N    Threads for writing tables, 0 for one per available CPU (default: 1, pipelined)\n");
+    fprintf(stderr, "  --serve SOCKET   Run as a conversion server on a Unix domain socket\n");
+    fprintf(stderr, "  --workers N      Worker threads of the server (default: 1; conversions still run one at a time)\n");
+    fprintf(stderr, "  --max-request BYTES  Refuse requests with more JSON than this (default: %zu)\n", DEFAULT_MAX_REQUEST);
+    fprintf(stderr, "  --connect SOCKET Convert through a running server; prints the output directory\n");
+    fprintf(stderr, "  --stream       With --connect, print the tables to stdout instead\n");
     exit(1);
 }
 
+// The command-line tool has nothing to unwind: a fatal error ends the run
+static void exit_on_fatal_error(void)
+{
+    exit(1);
+}
+
+// Write the CSV files: on the thread pool when there is one; or
+// formatting on this thread and writing on another when pipelined
+static int write_tables(Schema *schema, const char *out_dir, int pipeline)
+{
+    if (pool_size() > 1)
+    {
+        return write_schema_to_csv_parallel(schema, out_dir);
+    }
+    if (!pipeline)
+    {
+        return write_schema_to_csv(schema, out_dir);
+    }
+
+    Sink *dir = create_dir_sink(NULL, out_dir);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    Sink *out = open_output_pipe(dir);
+    int status = write_schema_to_sink(schema, out);
+    stats_begin(PHASE_WRITE);
+    if (close_output_pipe(out) != 0)
+    {
+        status = -1;
+    }
+    stats_end(PHASE_WRITE);
+    free_sink(dir);
+    return status;
+}
+
+// Read all of stdin, so it can be hashed before it is parsed
+static char *read_input(size_t *len)
+{
+    size_t capacity = 65536;
+    size_t size = 0;
+    char *buffer = malloc(capacity);
+    if (!buffer)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    size_t n;
+    while ((n = fread(buffer + size, 1, capacity - size, stdin)) > 0)
+    {
+        size += n;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            if (!buffer)
+            {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+        }
+    }
+    if (ferror(stdin))
+    {
+        fprintf(stderr, "Error: Could not read input\n");
+        exit(1);
+    }
+
+    *len = size;
+    return buffer;
+}
+
 int main(int argc, char **argv)
 {
     int print_ast = 0;
     char *out_dir = ".";
+    char *save_ast = NULL;
+    char *load_ast = NULL;
+    char *cache_dir = NULL;
+    int stats = 0;
+    char *stats_json = NULL;
+    int perf_counters = 0;
+    char *serve = NULL;
+    int workers = DEFAULT_SERVER_WORKERS;
+    size_t max_request = DEFAULT_MAX_REQUEST;
+    char *connect_to = NULL;
+    int stream = 0;
+    int pipeline = 1;
+    int threads = 1; // The pipeline unless --threads asks for a pool
+
+    set_fatal_handler(exit_on_fatal_error);
 
     // Parse command line arguments
     for (int i = 1; i < argc; i++)
@@ -32,6 +146,10 @@ int main(int argc, char **argv)
         {
             print_ast = 1;
         }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            scanner_trace = 1;
+        }
         else if (strcmp(argv[i], "--out-dir") == 0)
         {
             if (i + 1 < argc)
@@ -52,25 +170,304 @@ int main(int argc, char **argv)
                 print_usage(argv[0]);
             }
         }
+        else if (strcmp(argv[i], "--max-depth") == 0)
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+            {
+                json_max_depth = atoi(argv[++i]);
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--save-ast") == 0 || strcmp(argv[i], "--load-ast") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                if (argv[i][2] == 's')
+                    save_ast = argv[++i];
+                else
+                    load_ast = argv[++i];
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats = 1;
+        }
+        else if (strcmp(argv[i], "--perf-counters") == 0)
+        {
+            perf_counters = 1;
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                stats_json = argv[++i];
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--serve") == 0 || strcmp(argv[i], "--connect") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                if (argv[i][2] == 's')
+                    serve = argv[++i];
+                else
+                    connect_to = argv[++i];
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            if (i + 1 < argc && (atoi(argv[i + 1]) > 0 || strcmp(argv[i + 1], "0") == 0))
+            {
+                threads = atoi(argv[++i]);
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--workers") == 0)
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+            {
+                workers = atoi(argv[++i]);
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--max-request") == 0)
+        {
+            if (i + 1 < argc && strtoull(argv[i + 1], NULL, 10) > 0)
+            {
+                max_request = strtoull(argv[++i], NULL, 10);
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--no-pipeline") == 0)
+        {
+            pipeline = 0;
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            stream = 1;
+        }
+        else if (strcmp(argv[i], "--cache-dir") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                cache_dir = argv[++i];
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+        }
         else
         {
             print_usage(argv[0]);
         }
     }
 
-    // Parse JSON input
-    yyparse();
+    if (serve)
+    {
+        return run_server(serve, workers, max_request);
+    }
+    if (connect_to)
+    {
+        // The server resolves paths from its own working directory
+        char resolved[PATH_MAX];
+        if (!stream && realpath(out_dir, resolved) == NULL)
+        {
+            fprintf(stderr, "Error: Could not resolve directory %s\n", out_dir);
+            return 1;
+        }
+        size_t len;
+        char *input = read_input(&len);
+        int status = run_client(connect_to, input, len, stream ? NULL : resolved, json_max_depth);
+        free(input);
+        return status;
+    }
 
-    // Print AST if requested
-    if (print_ast)
+    // Before any thread starts, so the counters follow every thread
+    if (perf_counters)
     {
-        print_ast_node(root, 0);
+        perf_counters_open();
     }
+    pool_start(threads);
+
+    OutputCache cache;
+    if (cache_dir && open_cache(&cache, cache_dir) != 0)
+    {
+        return 1;
+    }
+
+    // Options that change the CSV files, as part of the cache key
+    char options[64];
+    snprintf(options, sizeof(options), "format=%d;input=%s", CACHE_FORMAT_VERSION,
+             load_ast ? "snapshot" : "json");
+
+    int cached = 0;
+    Tape *tape = NULL;
+    if (load_ast)
+    {
+        // A snapshot is already a tape, so skip lexing and parsing
+        stats_begin(PHASE_READ);
+        tape = load_tape(load_ast);
+        stats_end(PHASE_READ);
+        if (tape == NULL)
+        {
+            return 1;
+        }
+        run_stats.bytes_read = tape->mapping_size;
+
+        if (cache_dir)
+        {
+            stats_begin(PHASE_CACHE);
+            cache_key(&cache, tape->mapping, tape->mapping_size, options);
+            cached = cache_lookup(&cache, out_dir);
+            stats_end(PHASE_CACHE);
+        }
 
-    // Process AST and generate CSV files
-    process_ast(root, out_dir);
+        if (print_ast)
+        {
+            print_tape(tape);
+        }
+    }
+    else
+    {
+        char *input = NULL;
+        size_t len = 0;
+        YY_BUFFER_STATE buffer = NULL;
+        InputPipe *input_pipe = NULL;
+        if (cache_dir)
+        {
+            stats_begin(PHASE_READ);
+            input = read_input(&len);
+            stats_end(PHASE_READ);
+            if (len > INT_MAX)
+            {
+                fprintf(stderr, "Error: Input too large\n");
+                return 1;
+            }
+            stats_begin(PHASE_CACHE);
+            cache_key(&cache, input, len, options);
+            cached = cache_lookup(&cache, out_dir);
+            stats_end(PHASE_CACHE);
+            buffer = yy_scan_bytes(input, (int)len);
+        }
+        else if (pipeline)
+        {
+            input_pipe = open_input_pipe(STDIN_FILENO);
+            set_scanner_reader(input_pipe_reader, input_pipe);
+        }
+
+        // Parse JSON input straight into a tape, unless the cache already
+        // has its output and nothing else needs the document
+        if (!cached || print_ast || save_ast)
+        {
+            stats_begin(PHASE_PARSE);
+            tape = parse_document();
+            stats_end(PHASE_PARSE);
+        }
+        if (buffer)
+        {
+            yy_delete_buffer(buffer);
+            run_stats.bytes_read = len;
+        }
+        if (input_pipe)
+        {
+            set_scanner_reader(NULL, NULL);
+            close_input_pipe(input_pipe);
+        }
+        free(input);
+
+        if (print_ast)
+        {
+            print_tape(tape);
+        }
+    }
+
+    if (save_ast && save_tape(tape, save_ast) != 0)
+    {
+        free_tape(tape);
+        return 1;
+    }
+
+    // Process the tape and generate CSV files. Output that was not written
+    // in full fails the run and is not cached.
+    int status = 0;
+    if (!cached)
+    {
+        Schema *schema = convert_tape(tape);
+        if (schema != NULL)
+        {
+            if (write_tables(schema, out_dir, pipeline) != 0 || write_schema_sidecar(schema, out_dir) != 0)
+            {
+                fprintf(stderr, "Error: Could not write the tables to %s\n", out_dir);
+                status = 1;
+            }
+            else if (cache_dir)
+            {
+                stats_begin(PHASE_CACHE);
+                cache_store(&cache, schema, out_dir);
+                stats_end(PHASE_CACHE);
+            }
+            free_schema(schema);
+        }
+    }
+
+    pool_stop();
+    if (cache_dir)
+    {
+        fprintf(stderr, "Cache hits: %d, misses: %d (key %s)\n", cache.hits, cache.misses, cache.key);
+    }
+
+    if (stats)
+    {
+        print_stats(stderr);
+    }
+    if (perf_counters)
+    {
+        print_perf_counters(stderr, run_stats.bytes_read);
+    }
+    if (stats_json)
+    {
+        FILE *out = strcmp(stats_json, "-") == 0 ? stdout : fopen(stats_json, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Error: Could not open file %s for writing\n", stats_json);
+        }
+        else
+        {
+            print_stats_json(out);
+            if (out != stdout)
+                fclose(out);
+        }
+    }
 
     // Cleanup
-    free_ast_node(root);
-    return 0;
+    free_tape(tape);
+    free_table_name_cache();
+    free_stats();
+    perf_counters_close();
+    intern_free_all();
+    return status;
 }
\ No newline at end of file
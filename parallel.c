@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "alloc.h"
+#include "fatal.h"
+#include "stats.h"
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+typedef struct Loop
+{
+    void (*task)(int index, void *arg);
+    void *arg;
+    atomic_int pending; // Tasks not yet finished
+} Loop;
+
+typedef struct Task
+{
+    Loop *loop;
+    int index;
+} Task;
+
+// Ring of tasks. Tasks are short next to the time a lock takes, so both
+// the owner and thieves take the oldest task under the mutex: that keeps
+// the longest tasks, dealt out first, running first wherever they end up.
+typedef struct Deque
+{
+    pthread_mutex_t lock;
+    Task *tasks;
+    int capacity;
+    int head;
+    int count;
+} Deque;
+
+typedef struct PoolThread
+{
+    pthread_t thread;
+    int index;
+    Deque deque;
+    // Written only by the thread itself and read after it is joined
+    long long tasks;
+    long long steals;
+    double idle;
+} PoolThread;
+
+static PoolThread *pool;
+static int pool_threads = 1;
+static int stopping;
+static atomic_int queued; // Tasks in all deques
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_changed = PTHREAD_COND_INITIALIZER; // New tasks, a finished loop or stop
+static __thread int thread_index; // The thread that started the pool is 0
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// CPU quota
+
+// CPUs that a quota of quota microseconds per period allows, rounded up;
+// 0 without a quota
+static int quota_cpus(long long quota, long long period)
+{
+    if (quota <= 0 || period <= 0)
+        return 0;
+    return (int)((quota + period - 1) / period);
+}
+
+// cgroup v2: cpu.max holds "max <period>" or "<quota> <period>". Returns
+// -1 if the file does not exist.
+static int cpu_max_limit(const char *cgroup)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", cgroup);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    char quota[32];
+    long long period;
+    int limit = 0;
+    if (fscanf(file, "%31s %lld", quota, &period) == 2 && strcmp(quota, "max") != 0)
+        limit = quota_cpus(atoll(quota), period);
+    fclose(file);
+    return limit;
+}
+
+static int read_cgroup_number(const char *cgroup, const char *name, long long *value)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu%s/%s", cgroup, name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    int status = fscanf(file, "%lld", value) == 1 ? 0 : -1;
+    fclose(file);
+    return status;
+}
+
+// cgroup v1: a cfs_quota_us of -1 means no quota. Returns -1 if the files
+// do not exist.
+static int cfs_quota_limit(const char *cgroup)
+{
+    long long quota, period;
+    if (read_cgroup_number(cgroup, "cpu.cfs_quota_us", &quota) != 0 ||
+        read_cgroup_number(cgroup, "cpu.cfs_period_us", &period) != 0)
+        return -1;
+    return quota_cpus(quota, period);
+}
+
+static int has_controller(const char *controllers, const char *name)
+{
+    size_t len = strlen(name);
+    for (const char *p = controllers; *p; p += strcspn(p, ","), p += *p == ',')
+    {
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+    }
+    return 0;
+}
+
+// The CPU limit of this process's cgroup, 0 if there is none. Inside a
+// cgroup namespace the cgroup of /proc/self/cgroup is the mounted root, so
+// the root is tried when the full path does not exist.
+static int cgroup_cpu_limit(void)
+{
+    char v2[PATH_MAX] = "";
+    char v1[PATH_MAX] = "";
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (file != NULL)
+    {
+        char line[PATH_MAX + 64];
+        while (fgets(line, sizeof(line), file) != NULL)
+        {
+            // hierarchy-id:controllers:path
+            line[strcspn(line, "\n")] = '\0';
+            char *controllers = strchr(line, ':');
+            char *path = controllers ? strchr(controllers + 1, ':') : NULL;
+            if (path == NULL)
+                continue;
+            *controllers++ = '\0';
+            *path++ = '\0';
+            if (strcmp(line, "0") == 0 && *controllers == '\0')
+                snprintf(v2, sizeof(v2), "%s", strcmp(path, "/") == 0 ? "" : path);
+            else if (has_controller(controllers, "cpu"))
+                snprintf(v1, sizeof(v1), "%s", strcmp(path, "/") == 0 ? "" : path);
+        }
+        fclose(file);
+    }
+
+    int limit = cpu_max_limit(v2);
+    if (limit < 0 && v2[0] != '\0')
+        limit = cpu_max_limit("");
+    if (limit < 0)
+        limit = cfs_quota_limit(v1);
+    if (limit < 0 && v1[0] != '\0')
+        limit = cfs_quota_limit("");
+    return limit > 0 ? limit : 0;
+}
+
+int available_cpus(void)
+{
+    int cpus = 0;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        cpus = CPU_COUNT(&set);
+    if (cpus <= 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        cpus = online > 0 ? (int)online : 1;
+    }
+    int limit = cgroup_cpu_limit();
+    if (limit > 0 && limit < cpus)
+        cpus = limit;
+    return cpus;
+}
+
+// Deques
+
+static void deque_push(Deque *deque, Task task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity)
+    {
+        // Unwrap into a buffer twice the size
+        int capacity = deque->capacity ? deque->capacity * 2 : DEQUE_INITIAL_CAPACITY;
+        Task *tasks = xmalloc(capacity * sizeof(Task));
+        for (int i = 0; i < deque->count; i++)
+        {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        xfree(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    atomic_fetch_add(&queued, 1);
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static int deque_take(Deque *deque, Task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->count > 0;
+    if (found)
+    {
+        *task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+        atomic_fetch_sub(&queued, 1);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Pool
+
+// The thread's own oldest task, or else one stolen from the next thread
+// that has any
+static int find_task(PoolThread *self, Task *task)
+{
+    if (deque_take(&self->deque, task))
+        return 1;
+    for (int i = 1; i < pool_threads; i++)
+    {
+        PoolThread *victim = &pool[(self->index + i) % pool_threads];
+        if (deque_take(&victim->deque, task))
+        {
+            self->steals++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void run_task(PoolThread *self, Task task)
+{
+    task.loop->task(task.index, task.loop->arg);
+    self->tasks++;
+    // The loop lives on its caller's stack and may be gone once the last
+    // task is counted, so it is not touched after that
+    if (atomic_fetch_sub(&task.loop->pending, 1) == 1)
+    {
+        pthread_mutex_lock(&pool_lock);
+        pthread_cond_broadcast(&pool_changed);
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    PoolThread *self = arg;
+    thread_index = self->index;
+    for (;;)
+    {
+        Task task;
+        if (find_task(self, &task))
+        {
+            run_task(self, task);
+            continue;
+        }
+
+        double start = now();
+        pthread_mutex_lock(&pool_lock);
+        while (!stopping && atomic_load(&queued) == 0)
+        {
+            pthread_cond_wait(&pool_changed, &pool_lock);
+        }
+        int stop = stopping && atomic_load(&queued) == 0;
+        pthread_mutex_unlock(&pool_lock);
+        self->idle += now() - start;
+        if (stop)
+            return NULL;
+    }
+}
+
+int pool_start(int threads)
+{
+    if (pool != NULL)
+        return pool_threads;
+    if (threads <= 0)
+        threads = available_cpus();
+    if (threads <= 1)
+        return 1;
+
+    pool = xcalloc(threads, sizeof(PoolThread));
+    pool_threads = threads;
+    for (int i = 0; i < threads; i++)
+    {
+        pool[i].index = i;
+        pthread_mutex_init(&pool[i].deque.lock, NULL);
+    }
+    thread_index = 0;
+    for (int i = 1; i < threads; i++)
+    {
+        if (pthread_create(&pool[i].thread, NULL, worker_main, &pool[i]) != 0)
+            fatal_error("Error: Could not start worker thread %d", i);
+    }
+    return threads;
+}
+
+int pool_size(void)
+{
+    return pool_threads;
+}
+
+void parallel_for(int count, void (*task)(int index, void *arg), void *arg)
+{
+    if (pool == NULL)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            task(i, arg);
+        }
+        return;
+    }
+
+    Loop loop;
+    loop.task = task;
+    loop.arg = arg;
+    atomic_init(&loop.pending, count);
+    for (int i = 0; i < count; i++)
+    {
+        Task item = {&loop, i};
+        deque_push(&pool[(thread_index + i) % pool_threads].deque, item);
+    }
+    pthread_mutex_lock(&pool_lock);
+    pthread_cond_broadcast(&pool_changed);
+    pthread_mutex_unlock(&pool_lock);
+
+    // Help with any task, not only this loop's, until this loop is done
+    PoolThread *self = &pool[thread_index];
+    while (atomic_load(&loop.pending) > 0)
+    {
+        Task next;
+        if (find_task(self, &next))
+        {
+            run_task(self, next);
+            continue;
+        }
+
+        double start = now();
+        pthread_mutex_lock(&pool_lock);
+        while (atomic_load(&loop.pending) > 0 && atomic_load(&queued) == 0)
+        {
+            pthread_cond_wait(&pool_changed, &pool_lock);
+        }
+        pthread_mutex_unlock(&pool_lock);
+        self->idle += now() - start;
+    }
+}
+
+void pool_stop(void)
+{
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&pool_changed);
+    pthread_mutex_unlock(&pool_lock);
+    for (int i = 1; i < pool_threads; i++)
+    {
+        pthread_join(pool[i].thread, NULL);
+    }
+
+    xfree(run_stats.workers);
+    run_stats.workers = xcalloc(pool_threads, sizeof(WorkerStats));
+    run_stats.worker_count = pool_threads;
+    for (int i = 0; i < pool_threads; i++)
+    {
+        run_stats.workers[i].tasks = pool[i].tasks;
+        run_stats.workers[i].steals = pool[i].steals;
+        run_stats.workers[i].idle = pool[i].idle;
+        pthread_mutex_destroy(&pool[i].deque.lock);
+        xfree(pool[i].deque.tasks);
+    }
+
+    xfree(pool);
+    pool = NULL;
+    pool_threads = 1;
+    stopping = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Work-stealing thread pool behind every parallel loop of the converter.
+//
+// Each thread, the one that started the pool included, owns a deque of
+// tasks. A loop deals its tasks round-robin onto the deques, owners take
+// their own tasks in order, and a thread whose deque is empty steals the
+// oldest task of another, so a thread stuck on a long table does not hold
+// back the rest. The pool uses the tracked allocator, so it must not run
+// while allocation tracking is on.
+
+// Usable CPUs: the affinity mask, capped by a cgroup CPU quota
+int available_cpus(void);
+
+// Start threads - 1 workers, or one thread per available CPU if threads is
+// 0 or less. Returns the size of the pool.
+int pool_start(int threads);
+
+// Threads in the pool, counting the one that started it; 1 when none runs
+int pool_size(void);
+
+// Run task(index, arg) for every index below count on the pool, the
+// calling thread among them, and return when all have finished. Indexes
+// are dealt out in increasing order, so callers put the longest tasks
+// first. Without a pool the tasks run in order on the calling thread.
+void parallel_for(int count, void (*task)(int index, void *arg), void *arg);
+
+// Join the workers and record their counters in run_stats
+void pool_stop(void);
+
+#endif // PARALLEL_H
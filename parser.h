@@ -1,17 +1,46 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#include "ast.h"
+#include "tape.h"
 
 // Yacc/Bison variables
 extern int yylineno;
 extern int yycolumn;
 extern char *yytext;
-extern Node *root;
+
+// Deepest nesting of objects and arrays the parser accepts
+#define DEFAULT_MAX_DEPTH 100000
+extern int json_max_depth;
+
+// Print every token to stdout as it is scanned. Off unless the
+// command-line tool is run with --trace, so the library never writes to
+// stdout.
+extern int scanner_trace;
 
 // Function declarations
 void yyerror(const char *s);
 int yylex(void);
 int yyparse(void);
 
+// Parse the scanner's input straight into a tape, without an AST. Ends in
+// fatal_error on a syntax error or a document nested too deep.
+Tape *parse_document(void);
+
+// Scan an in-memory buffer instead of stdin
+#ifndef YY_TYPEDEF_YY_BUFFER_STATE
+#define YY_TYPEDEF_YY_BUFFER_STATE
+typedef struct yy_buffer_state *YY_BUFFER_STATE;
+#endif
+YY_BUFFER_STATE yy_scan_bytes(const char *bytes, int len);
+void yy_delete_buffer(YY_BUFFER_STATE buffer);
+
+// Where the scanner gets its input when it is not scanning a buffer: up to
+// max_size bytes copied to buf, 0 at the end. NULL reads yyin.
+typedef size_t (*ScannerReader)(char *buf, size_t max_size, void *data);
+void set_scanner_reader(ScannerReader reader, void *data);
+
+// Release the scanner's buffers and start over at line 1, even after a
+// parse that was abandoned halfway; also removes the ScannerReader
+void reset_scanner(void);
+
 #endif // PARSER_H
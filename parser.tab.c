@@ -72,9 +72,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "ast.h"
+#include "tape.h"
 #include "schema.h"
 #include "common.h"
+#include "parser.h"
+#include "alloc.h"
+#include "fatal.h"
 
 /* Declare yycolumn as extern */
 extern int yycolumn;
@@ -84,9 +87,24 @@ extern char* yytext;
 void yyerror(const char* s);
 int yylex(void);
 
-Node* root = NULL;
+int json_max_depth = DEFAULT_MAX_DEPTH;
 
-#line 90 "parser.tab.c"
+/* The tape parse_document is building. LR parsing reduces each value
+   before it shifts the next token, so the actions append to it in
+   document order. */
+static TapeBuilder* builder;
+
+/* Each level of nesting takes at most five stack entries: a key after a
+   comma keeps the object's start, pairs, ',', key and ':' on the stack
+   while its value is parsed. Size the parser stack from the depth limit
+   the scanner enforces. */
+#define YYMAXDEPTH (5 * (long)json_max_depth + 200)
+
+/* A grown parser stack comes from the converter's allocator too */
+#define YYMALLOC xmalloc
+#define YYFREE xfree
+
+#line 108 "parser.tab.c"
 
 # ifndef YY_CAST
 #  ifdef __cplusplus
@@ -132,10 +150,13 @@ enum yysymbol_kind_t
   YYSYMBOL_json = 15,                      /* json  */
   YYSYMBOL_value = 16,                     /* value  */
   YYSYMBOL_object = 17,                    /* object  */
-  YYSYMBOL_pairs = 18,                     /* pairs  */
-  YYSYMBOL_pair = 19,                      /* pair  */
-  YYSYMBOL_array = 20,                     /* array  */
-  YYSYMBOL_elements = 21                   /* elements  */
+  YYSYMBOL_object_start = 18,              /* object_start  */
+  YYSYMBOL_pairs = 19,                     /* pairs  */
+  YYSYMBOL_pair = 20,                      /* pair  */
+  YYSYMBOL_key = 21,                       /* key  */
+  YYSYMBOL_array = 22,                     /* array  */
+  YYSYMBOL_array_start = 23,               /* array_start  */
+  YYSYMBOL_elements = 24                   /* elements  */
 };
 typedef enum yysymbol_kind_t yysymbol_kind_t;
 
@@ -464,18 +485,18 @@ union yyalloc
 #endif /* !YYCOPY_NEEDED */
 
 /* YYFINAL -- State number of the termination state.  */
-#define YYFINAL  20
+#define YYFINAL  8
 /* YYLAST -- Last index in YYTABLE.  */
 #define YYLAST   30
 
 /* YYNTOKENS -- Number of terminals.  */
 #define YYNTOKENS  14
 /* YYNNTS -- Number of nonterminals.  */
-#define YYNNTS  8
+#define YYNNTS  11
 /* YYNRULES -- Number of rules.  */
-#define YYNRULES  19
+#define YYNRULES  22
 /* YYNSTATES -- Number of states.  */
-#define YYNSTATES  29
+#define YYNSTATES  32
 
 /* YYMAXUTOK -- Last valid token kind.  */
 #define YYMAXUTOK   268
@@ -525,8 +546,9 @@ static const yytype_int8 yytranslate[] =
 /* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
 static const yytype_int8 yyrline[] =
 {
-       0,    42,    42,    43,    46,    47,    48,    49,    50,    51,
-      52,    55,    56,    60,    61,    72,    84,    85,    89,    99
+       0,    51,    51,    52,    55,    56,    57,    58,    59,    60,
+      61,    64,    65,    68,    71,    72,    75,    78,    81,    82,
+      85,    88,    89
 };
 #endif
 
@@ -544,8 +566,8 @@ static const char *const yytname[] =
 {
   "\"end of file\"", "error", "\"invalid token\"", "NUMBER", "STRING",
   "TRUE", "FALSE", "NULL_VAL", "LBRACE", "RBRACE", "LBRACKET", "RBRACKET",
-  "COLON", "COMMA", "$accept", "json", "value", "object", "pairs", "pair",
-  "array", "elements", YY_NULLPTR
+  "COLON", "COMMA", "$accept", "json", "value", "object", "object_start",
+  "pairs", "pair", "key", "array", "array_start", "elements", YY_NULLPTR
 };
 
 static const char *
@@ -569,9 +591,10 @@ yysymbol_name (yysymbol_kind_t yysymbol)
    STATE-NUM.  */
 static const yytype_int8 yypact[] =
 {
-      14,    11,    -3,    18,    -7,    -7,    -6,    -7,     8,    -7,
-      -7,    -7,    -7,    -7,    -7,    -7,    -7,    -7,    -7,    15,
-      -7,     6,    -7,    21,    -7,     6,    -7,    -7,    -7
+      14,    -7,    -7,    18,    -7,    11,    -7,    -3,    -7,    -7,
+      -7,     8,    -7,    -6,    -7,    -7,    -7,    -7,    -7,    -7,
+      -7,    -7,    -7,    12,    -7,    15,     6,    -7,     6,    -7,
+      -7,    -7
 };
 
 /* YYDEFACT[STATE-NUM] -- Default reduction number in state STATE-NUM.
@@ -579,21 +602,24 @@ static const yytype_int8 yypact[] =
    means the default is an error.  */
 static const yytype_int8 yydefact[] =
 {
-       0,     0,     0,     0,     2,     3,     0,    12,     0,    13,
-       7,     6,     8,     9,    10,    17,    18,     4,     5,     0,
-       1,     0,    11,     0,    16,     0,    15,    14,    19
+       0,    13,    20,     0,     2,     0,     3,     0,     1,    17,
+      12,     0,    14,     0,     7,     6,     8,     9,    10,    19,
+      21,     4,     5,     0,    11,     0,     0,    18,     0,    15,
+      16,    22
 };
 
 /* YYPGOTO[NTERM-NUM].  */
 static const yytype_int8 yypgoto[] =
 {
-      -7,    -7,    -2,    27,    -7,     7,    29,    -7
+      -7,    -7,     0,    27,    -7,    -7,     4,    -7,    30,    -7,
+      -7
 };
 
 /* YYDEFGOTO[NTERM-NUM].  */
 static const yytype_int8 yydefgoto[] =
 {
-       0,     3,    16,    17,     8,     9,    18,    19
+       0,     3,    20,    21,     5,    11,    12,    13,    22,     7,
+      23
 };
 
 /* YYTABLE[YYPACT[STATE-NUM]] -- What to do in state STATE-NUM.  If
@@ -601,41 +627,44 @@ static const yytype_int8 yydefgoto[] =
    number is the opposite.  If YYTABLE_NINF, syntax error.  */
 static const yytype_int8 yytable[] =
 {
-      10,    11,    12,    13,    14,     1,    21,     2,    15,    10,
-      11,    12,    13,    14,     1,     6,     2,    22,    20,    26,
-       7,    23,     1,    28,     2,     6,    24,     4,    25,     5,
-      27
+      14,    15,    16,    17,    18,     1,    26,     2,    19,    14,
+      15,    16,    17,    18,     1,     9,     2,    24,     8,     9,
+      10,    25,     1,    27,     2,    28,    30,     4,    31,    29,
+       6
 };
 
 static const yytype_int8 yycheck[] =
 {
        3,     4,     5,     6,     7,     8,    12,    10,    11,     3,
-       4,     5,     6,     7,     8,     4,    10,     9,     0,    21,
-       9,    13,     8,    25,    10,     4,    11,     0,    13,     0,
-      23
+       4,     5,     6,     7,     8,     4,    10,     9,     0,     4,
+       9,    13,     8,    11,    10,    13,    26,     0,    28,    25,
+       0
 };
 
 /* YYSTOS[STATE-NUM] -- The symbol kind of the accessing symbol of
    state STATE-NUM.  */
 static const yytype_int8 yystos[] =
 {
-       0,     8,    10,    15,    17,    20,     4,     9,    18,    19,
-       3,     4,     5,     6,     7,    11,    16,    17,    20,    21,
-       0,    12,     9,    13,    11,    13,    16,    19,    16
+       0,     8,    10,    15,    17,    18,    22,    23,     0,     4,
+       9,    19,    20,    21,     3,     4,     5,     6,     7,    11,
+      16,    17,    22,    24,     9,    13,    12,    11,    13,    20,
+      16,    16
 };
 
 /* YYR1[RULE-NUM] -- Symbol kind of the left-hand side of rule RULE-NUM.  */
 static const yytype_int8 yyr1[] =
 {
        0,    14,    15,    15,    16,    16,    16,    16,    16,    16,
-      16,    17,    17,    18,    18,    19,    20,    20,    21,    21
+      16,    17,    17,    18,    19,    19,    20,    21,    22,    22,
+      23,    24,    24
 };
 
 /* YYR2[RULE-NUM] -- Number of symbols on the right-hand side of rule RULE-NUM.  */
 static const yytype_int8 yyr2[] =
 {
        0,     2,     1,     1,     1,     1,     1,     1,     1,     1,
-       1,     3,     2,     1,     3,     3,     3,     2,     1,     3
+       1,     3,     2,     1,     1,     3,     3,     1,     3,     2,
+       1,     1,     3
 };
 
 
@@ -1211,140 +1240,80 @@ yyreduce:
   YY_REDUCE_PRINT (yyn);
   switch (yyn)
     {
-  case 2: /* json: object  */
-#line 42 "parser.y"
-             { root = (yyvsp[0].node); }
-#line 1218 "parser.tab.c"
-    break;
-
-  case 3: /* json: array  */
-#line 43 "parser.y"
-            { root = (yyvsp[0].node); }
-#line 1224 "parser.tab.c"
-    break;
-
   case 6: /* value: STRING  */
-#line 48 "parser.y"
-              { (yyval.node) = create_string_node((yyvsp[0].str)); }
-#line 1230 "parser.tab.c"
+#line 57 "parser.y"
+              { tape_build_string(builder, (yyvsp[0].str)); xfree((yyvsp[0].str)); }
+#line 1247 "parser.tab.c"
     break;
 
   case 7: /* value: NUMBER  */
-#line 49 "parser.y"
-              { (yyval.node) = create_number_node((yyvsp[0].num)); }
-#line 1236 "parser.tab.c"
+#line 58 "parser.y"
+              { tape_build_number(builder, (yyvsp[0].str)); xfree((yyvsp[0].str)); }
+#line 1253 "parser.tab.c"
     break;
 
   case 8: /* value: TRUE  */
-#line 50 "parser.y"
-            { (yyval.node) = create_boolean_node(1); }
-#line 1242 "parser.tab.c"
+#line 59 "parser.y"
+            { tape_build_literal(builder, TAPE_TRUE); }
+#line 1259 "parser.tab.c"
     break;
 
   case 9: /* value: FALSE  */
-#line 51 "parser.y"
-             { (yyval.node) = create_boolean_node(0); }
-#line 1248 "parser.tab.c"
+#line 60 "parser.y"
+             { tape_build_literal(builder, TAPE_FALSE); }
+#line 1265 "parser.tab.c"
     break;
 
   case 10: /* value: NULL_VAL  */
-#line 52 "parser.y"
-                { (yyval.node) = create_null_node(); }
-#line 1254 "parser.tab.c"
+#line 61 "parser.y"
+                { tape_build_literal(builder, TAPE_NULL); }
+#line 1271 "parser.tab.c"
     break;
 
-  case 11: /* object: LBRACE pairs RBRACE  */
-#line 55 "parser.y"
-                            { (yyval.node) = create_object_node((yyvsp[-1].pair)); }
-#line 1260 "parser.tab.c"
+  case 11: /* object: object_start pairs RBRACE  */
+#line 64 "parser.y"
+                                  { tape_build_close(builder); }
+#line 1277 "parser.tab.c"
     break;
 
-  case 12: /* object: LBRACE RBRACE  */
-#line 56 "parser.y"
-                      { (yyval.node) = create_object_node(NULL); }
-#line 1266 "parser.tab.c"
+  case 12: /* object: object_start RBRACE  */
+#line 65 "parser.y"
+                            { tape_build_close(builder); }
+#line 1283 "parser.tab.c"
     break;
 
-  case 13: /* pairs: pair  */
-#line 60 "parser.y"
-           { (yyval.pair) = (yyvsp[0].pair); }
-#line 1272 "parser.tab.c"
+  case 13: /* object_start: LBRACE  */
+#line 68 "parser.y"
+                     { tape_build_open(builder, TAPE_OBJECT_START); }
+#line 1289 "parser.tab.c"
     break;
 
-  case 14: /* pairs: pairs COMMA pair  */
-#line 61 "parser.y"
-                       { 
-        /* Fix: Link pairs in the correct order */
-        Pair* current = (yyvsp[-2].pair);
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = (yyvsp[0].pair);
-        (yyval.pair) = (yyvsp[-2].pair);
-      }
-#line 1286 "parser.tab.c"
+  case 17: /* key: STRING  */
+#line 78 "parser.y"
+            { tape_build_key(builder, intern_string((yyvsp[0].str))); xfree((yyvsp[0].str)); }
+#line 1295 "parser.tab.c"
     break;
 
-  case 15: /* pair: STRING COLON value  */
-#line 72 "parser.y"
-                         { 
-    Pair* p = malloc(sizeof(Pair));
-    if (!p) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
-    p->key = strdup((yyvsp[-2].str));
-    p->value = (yyvsp[0].node);
-    p->next = NULL;
-    (yyval.pair) = p;
-}
-#line 1302 "parser.tab.c"
+  case 18: /* array: array_start elements RBRACKET  */
+#line 81 "parser.y"
+                                     { tape_build_close(builder); }
+#line 1301 "parser.tab.c"
     break;
 
-  case 16: /* array: LBRACKET elements RBRACKET  */
-#line 84 "parser.y"
-                                  { (yyval.node) = create_array_node((yyvsp[-1].element)); }
-#line 1308 "parser.tab.c"
+  case 19: /* array: array_start RBRACKET  */
+#line 82 "parser.y"
+                            { tape_build_close(builder); }
+#line 1307 "parser.tab.c"
     break;
 
-  case 17: /* array: LBRACKET RBRACKET  */
+  case 20: /* array_start: LBRACKET  */
 #line 85 "parser.y"
-                         { (yyval.node) = create_array_node(NULL); }
-#line 1314 "parser.tab.c"
-    break;
-
-  case 18: /* elements: value  */
-#line 89 "parser.y"
-            { 
-          Element* e = malloc(sizeof(Element));
-          if (!e) {
-              fprintf(stderr, "Memory allocation failed\n");
-              exit(1);
-          }
-          e->value = (yyvsp[0].node);
-          e->next = NULL;
-          (yyval.element) = e;
-      }
-#line 1329 "parser.tab.c"
-    break;
-
-  case 19: /* elements: elements COMMA value  */
-#line 99 "parser.y"
-                           { 
-          Element* e = malloc(sizeof(Element));
-          if (!e) {
-              fprintf(stderr, "Memory allocation failed\n");
-              exit(1);
-          }
-          e->value = (yyvsp[0].node);
-          e->next = (yyvsp[-2].element);
-          (yyval.element) = e;
-      }
-#line 1344 "parser.tab.c"
+                      { tape_build_open(builder, TAPE_ARRAY_START); }
+#line 1313 "parser.tab.c"
     break;
 
 
-#line 1348 "parser.tab.c"
+#line 1317 "parser.tab.c"
 
       default: break;
     }
@@ -1542,12 +1511,21 @@ yyreturnlab:
   return yyresult;
 }
 
-#line 111 "parser.y"
+#line 92 "parser.y"
 
 
 void yyerror(const char* s) {
-    fprintf(stderr, "Error: %s at line %d\n", s, yylineno);
-    fprintf(stderr, "Current token: '%s'\n", yytext);
-    fprintf(stderr, "Expected one of: {, }, [, ], :, ,, \", number, true, false, null\n");
-    exit(1);
+    fatal_error("Error: %s at line %d\n"
+                "Current token: '%s'\n"
+                "Expected one of: {, }, [, ], :, ,, \", number, true, false, null",
+                s, yylineno, yytext);
+}
+
+Tape* parse_document(void) {
+    TapeBuilder document;
+    tape_build_begin(&document);
+    builder = &document;
+    yyparse();
+    builder = NULL;
+    return tape_build_end(&document);
 }
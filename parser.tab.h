@@ -73,15 +73,11 @@ extern int yydebug;
 #if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
 union YYSTYPE
 {
-#line 23 "parser.y"
+#line 41 "parser.y"
 
-    double num;
     char* str;
-    Node* node;
-    Pair* pair;
-    Element* element;
 
-#line 85 "parser.tab.h"
+#line 81 "parser.tab.h"
 
 };
 typedef union YYSTYPE YYSTYPE;
@@ -2,9 +2,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "ast.h"
+#include "tape.h"
 #include "schema.h"
 #include "common.h"
+#include "parser.h"
+#include "alloc.h"
+#include "fatal.h"
 
 /* Declare yycolumn as extern */
 extern int yycolumn;
@@ -14,105 +17,92 @@ extern char* yytext;
 void yyerror(const char* s);
 int yylex(void);
 
-Node* root = NULL;
+int json_max_depth = DEFAULT_MAX_DEPTH;
+
+/* The tape parse_document is building. LR parsing reduces each value
+   before it shifts the next token, so the actions append to it in
+   document order. */
+static TapeBuilder* builder;
+
+/* Each level of nesting takes at most five stack entries: a key after a
+   comma keeps the object's start, pairs, ',', key and ':' on the stack
+   while its value is parsed. Size the parser stack from the depth limit
+   the scanner enforces. */
+#define YYMAXDEPTH (5 * (long)json_max_depth + 200)
+
+/* A grown parser stack comes from the converter's allocator too */
+#define YYMALLOC xmalloc
+#define YYFREE xfree
 %}
 
 %locations
 %defines
 
 %union {
-    double num;
     char* str;
-    Node* node;
-    Pair* pair;
-    Element* element;
 }
 
-%token <num> NUMBER
-%token <str> STRING
+%token <str> NUMBER STRING
 %token TRUE FALSE NULL_VAL
 %token LBRACE RBRACE LBRACKET RBRACKET COLON COMMA
 
-%type <node> json value object array
-%type <pair> pairs pair
-%type <element> elements
-
 %%
 
-json: object { root = $1; }
-    | array { root = $1; }
+json: object
+    | array
     ;
 
 value: object
      | array
-     | STRING { $$ = create_string_node($1); }
-     | NUMBER { $$ = create_number_node($1); }
-     | TRUE { $$ = create_boolean_node(1); }
-     | FALSE { $$ = create_boolean_node(0); }
-     | NULL_VAL { $$ = create_null_node(); }
+     | STRING { tape_build_string(builder, $1); xfree($1); }
+     | NUMBER { tape_build_number(builder, $1); xfree($1); }
+     | TRUE { tape_build_literal(builder, TAPE_TRUE); }
+     | FALSE { tape_build_literal(builder, TAPE_FALSE); }
+     | NULL_VAL { tape_build_literal(builder, TAPE_NULL); }
      ;
 
-object: LBRACE pairs RBRACE { $$ = create_object_node($2); }
-      | LBRACE RBRACE { $$ = create_object_node(NULL); }
+object: object_start pairs RBRACE { tape_build_close(builder); }
+      | object_start RBRACE { tape_build_close(builder); }
       ;
 
-pairs:
-      pair { $$ = $1; }
-    | pairs COMMA pair { 
-        /* Fix: Link pairs in the correct order */
-        Pair* current = $1;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = $3;
-        $$ = $1;
-      }
-    ;
+object_start: LBRACE { tape_build_open(builder, TAPE_OBJECT_START); }
+            ;
 
-pair: STRING COLON value { 
-    Pair* p = malloc(sizeof(Pair));
-    if (!p) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
-    p->key = strdup($1);
-    p->value = $3;
-    p->next = NULL;
-    $$ = p;
-};
-
-array: LBRACKET elements RBRACKET { $$ = create_array_node($2); }
-     | LBRACKET RBRACKET { $$ = create_array_node(NULL); }
+pairs: pair
+     | pairs COMMA pair
      ;
 
-elements:
-      value { 
-          Element* e = malloc(sizeof(Element));
-          if (!e) {
-              fprintf(stderr, "Memory allocation failed\n");
-              exit(1);
-          }
-          e->value = $1;
-          e->next = NULL;
-          $$ = e;
-      }
-    | elements COMMA value { 
-          Element* e = malloc(sizeof(Element));
-          if (!e) {
-              fprintf(stderr, "Memory allocation failed\n");
-              exit(1);
-          }
-          e->value = $3;
-          e->next = $1;
-          $$ = e;
-      }
+pair: key COLON value
     ;
 
+key: STRING { tape_build_key(builder, intern_string($1)); xfree($1); }
+   ;
+
+array: array_start elements RBRACKET { tape_build_close(builder); }
+     | array_start RBRACKET { tape_build_close(builder); }
+     ;
+
+array_start: LBRACKET { tape_build_open(builder, TAPE_ARRAY_START); }
+           ;
+
+elements: value
+        | elements COMMA value
+        ;
+
 %%
 
 void yyerror(const char* s) {
-    fprintf(stderr, "Error: %s at line %d\n", s, yylineno);
-    fprintf(stderr, "Current token: '%s'\n", yytext);
-    fprintf(stderr, "Expected one of: {, }, [, ], :, ,, \", number, true, false, null\n");
-    exit(1);
-}
\ No newline at end of file
+    fatal_error("Error: %s at line %d\n"
+                "Current token: '%s'\n"
+                "Expected one of: {, }, [, ], :, ,, \", number, true, false, null",
+                s, yylineno, yytext);
+}
+
+Tape* parse_document(void) {
+    TapeBuilder document;
+    tape_build_begin(&document);
+    builder = &document;
+    yyparse();
+    builder = NULL;
+    return tape_build_end(&document);
+}
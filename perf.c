@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "perf.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+static int fds[COUNTER_COUNT] = {-1, -1, -1, -1, -1};
+static int open_count = 0;
+static uint64_t start[PHASE_COUNT][COUNTER_COUNT];
+static uint64_t totals[PHASE_COUNT][COUNTER_COUNT];
+static int counted[PHASE_COUNT];
+
+#ifdef __linux__
+static int open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1; // Allowed at the default perf_event_paranoid level
+    attr.exclude_hv = 1;
+    // Count the pool and pipeline threads started after the counters are
+    // opened too; reads return the sum over all of them
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Current value of a counter, scaled up when the kernel had to multiplex it
+static uint64_t read_counter(int fd)
+{
+    uint64_t values[3];
+    if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0)
+        return 0;
+    if (values[2] < values[1])
+        return (uint64_t)((double)values[0] * values[1] / values[2]);
+    return values[0];
+}
+#endif
+
+// Open every counter the machine provides. Returns the number opened, and
+// explains on stderr why none could be.
+int perf_counters_open(void)
+{
+#ifdef __linux__
+    const uint32_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D |
+                                   (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const struct
+    {
+        uint32_t type;
+        uint64_t config;
+    } events[COUNTER_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, l1d_read_miss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    int error = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        fds[i] = open_counter(events[i].type, events[i].config);
+        if (fds[i] < 0)
+        {
+            error = errno;
+            continue;
+        }
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        open_count++;
+    }
+
+    if (open_count == 0)
+    {
+        fprintf(stderr, "Warning: Hardware performance counters unavailable (%s); "
+                        "continuing without them\n", strerror(error));
+        if (error == EACCES || error == EPERM)
+            fprintf(stderr, "Check /proc/sys/kernel/perf_event_paranoid\n");
+    }
+    return open_count;
+#else
+    fprintf(stderr, "Warning: Hardware performance counters are only supported on Linux; "
+                    "continuing without them\n");
+    return 0;
+#endif
+}
+
+int perf_counters_available(void)
+{
+    return open_count > 0;
+}
+
+void perf_phase_begin(Phase phase)
+{
+#ifdef __linux__
+    if (open_count == 0)
+        return;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (fds[i] >= 0)
+            start[phase][i] = read_counter(fds[i]);
+    }
+#else
+    (void)phase;
+#endif
+}
+
+void perf_phase_end(Phase phase)
+{
+#ifdef __linux__
+    if (open_count == 0)
+        return;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (fds[i] >= 0)
+            totals[phase][i] += read_counter(fds[i]) - start[phase][i];
+    }
+    counted[phase] = 1;
+#else
+    (void)phase;
+#endif
+}
+
+static double per_mb(uint64_t count, long long bytes)
+{
+    return bytes > 0 ? count / (bytes / (1024.0 * 1024.0)) : 0.0;
+}
+
+void print_perf_counters(FILE *out, long long bytes)
+{
+    if (open_count == 0)
+        return;
+
+    fprintf(out, "%-10s %14s %14s %6s %12s %12s %12s\n", "phase", "cycles", "instructions", "IPC",
+            "L1D miss/MB", "LLC miss/MB", "br miss/MB");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        if (!counted[p])
+            continue;
+
+        fprintf(out, "%-10s", phase_name(p));
+        for (int i = COUNTER_CYCLES; i <= COUNTER_INSTRUCTIONS; i++)
+        {
+            if (fds[i] >= 0)
+                fprintf(out, " %14llu", (unsigned long long)totals[p][i]);
+            else
+                fprintf(out, " %14s", "n/a");
+        }
+
+        if (fds[COUNTER_CYCLES] >= 0 && fds[COUNTER_INSTRUCTIONS] >= 0 && totals[p][COUNTER_CYCLES] > 0)
+            fprintf(out, " %6.2f", (double)totals[p][COUNTER_INSTRUCTIONS] / totals[p][COUNTER_CYCLES]);
+        else
+            fprintf(out, " %6s", "n/a");
+
+        for (int i = COUNTER_L1D_MISSES; i < COUNTER_COUNT; i++)
+        {
+            if (fds[i] >= 0)
+                fprintf(out, " %12.0f", per_mb(totals[p][i], bytes));
+            else
+                fprintf(out, " %12s", "n/a");
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void print_perf_counters_json(FILE *out, long long bytes)
+{
+    fprintf(out, "{");
+    int first = 1;
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        if (!counted[p])
+            continue;
+
+        fprintf(out, "%s\n    \"%s\": {", first ? "" : ",", phase_name(p));
+        first = 0;
+        for (int i = 0; i < COUNTER_COUNT; i++)
+        {
+            if (fds[i] >= 0)
+                fprintf(out, "\"%s\": %llu, ", counter_names[i], (unsigned long long)totals[p][i]);
+            else
+                fprintf(out, "\"%s\": null, ", counter_names[i]);
+        }
+        for (int i = COUNTER_L1D_MISSES; i < COUNTER_COUNT; i++)
+        {
+            if (fds[i] >= 0)
+                fprintf(out, "\"%s_per_mb\": %.1f, ", counter_names[i], per_mb(totals[p][i], bytes));
+            else
+                fprintf(out, "\"%s_per_mb\": null, ", counter_names[i]);
+        }
+        if (fds[COUNTER_CYCLES] >= 0 && fds[COUNTER_INSTRUCTIONS] >= 0 && totals[p][COUNTER_CYCLES] > 0)
+            fprintf(out, "\"ipc\": %.3f}", (double)totals[p][COUNTER_INSTRUCTIONS] / totals[p][COUNTER_CYCLES]);
+        else
+            fprintf(out, "\"ipc\": null}");
+    }
+    fprintf(out, "%s}", first ? "" : "\n  ");
+}
+
+void perf_counters_close(void)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+    open_count = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdio.h>
+#include "stats.h"
+
+// Hardware counters read around each phase with perf_event_open. Counters
+// the kernel or CPU does not provide are skipped; when none can be opened
+// the phases run uncounted.
+typedef enum
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+} Counter;
+
+// Perf counter operations
+int perf_counters_open(void);
+int perf_counters_available(void);
+void perf_phase_begin(Phase phase);
+void perf_phase_end(Phase phase);
+void print_perf_counters(FILE *out, long long bytes);
+void print_perf_counters_json(FILE *out, long long bytes);
+void perf_counters_close(void);
+
+#endif // PERF_H
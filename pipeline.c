@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "alloc.h"
+#include "fatal.h"
+#include "stats.h"
+
+// Three slots per queue keep both sides busy; the stages run at steady
+// rates, so deeper queues only add resident memory
+#define INPUT_BLOCK_SIZE (256 * 1024)
+#define INPUT_BLOCKS 3
+#define OUTPUT_CHUNK_SIZE 65536 // The size write_schema_to_sink flushes in
+#define OUTPUT_CHUNKS 3
+
+// Bounded single-producer, single-consumer queue without a mutex: each
+// side owns its index, and the semaphores count filled and free slots.
+// Their fast path is one atomic operation, so a thread only enters the
+// kernel to sleep when the queue is empty or full, which counts as a wait.
+typedef struct Ring
+{
+    void **slots;
+    size_t capacity;
+    size_t head; // Next slot to take, owned by the consumer
+    size_t tail; // Next slot to fill, owned by the producer
+    sem_t items;
+    sem_t spaces;
+    long long push_waits;
+    long long pop_waits;
+} Ring;
+
+typedef struct InputBlock
+{
+    size_t len;
+    int end; // Last block: no data, end of input or a read error
+    char data[INPUT_BLOCK_SIZE];
+} InputBlock;
+
+struct InputPipe
+{
+    int fd;
+    pthread_t thread;
+    Ring filled;
+    Ring empty;
+    InputBlock *blocks;
+    InputBlock *current;
+    size_t offset;
+    int finished;
+    int error; // errno of a failed read
+};
+
+typedef enum
+{
+    CHUNK_BEGIN, // data holds the table name
+    CHUNK_WRITE,
+    CHUNK_END,
+    CHUNK_STOP
+} ChunkKind;
+
+typedef struct OutputChunk
+{
+    ChunkKind kind;
+    size_t len;
+    char data[OUTPUT_CHUNK_SIZE];
+} OutputChunk;
+
+typedef struct OutputPipe
+{
+    Sink base;
+    Sink *target;
+    pthread_t thread;
+    Ring filled;
+    Ring empty;
+    OutputChunk *chunks;
+    int status; // Written by the writer, read after it is joined
+} OutputPipe;
+
+static void ring_init(Ring *ring, size_t capacity)
+{
+    ring->slots = xcalloc(capacity, sizeof(void *));
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    sem_init(&ring->items, 0, 0);
+    sem_init(&ring->spaces, 0, capacity);
+    ring->push_waits = 0;
+    ring->pop_waits = 0;
+}
+
+static void ring_destroy(Ring *ring)
+{
+    sem_destroy(&ring->items);
+    sem_destroy(&ring->spaces);
+    xfree(ring->slots);
+}
+
+static void ring_wait(sem_t *sem, long long *waits)
+{
+    if (sem_trywait(sem) == 0)
+        return;
+    (*waits)++;
+    while (sem_wait(sem) != 0)
+    {
+        // Interrupted by a signal
+    }
+}
+
+static void ring_push(Ring *ring, void *item)
+{
+    ring_wait(&ring->spaces, &ring->push_waits);
+    ring->slots[ring->tail++ % ring->capacity] = item;
+    sem_post(&ring->items);
+}
+
+static void *ring_pop(Ring *ring)
+{
+    ring_wait(&ring->items, &ring->pop_waits);
+    void *item = ring->slots[ring->head++ % ring->capacity];
+    sem_post(&ring->spaces);
+    return item;
+}
+
+// Input
+
+static void *reader_main(void *arg)
+{
+    InputPipe *pipe = arg;
+    for (;;)
+    {
+        InputBlock *block = ring_pop(&pipe->empty);
+        ssize_t n;
+        do
+        {
+            n = read(pipe->fd, block->data, sizeof(block->data));
+        } while (n < 0 && errno == EINTR);
+
+        if (n <= 0)
+        {
+            if (n < 0)
+                pipe->error = errno;
+            block->len = 0;
+            block->end = 1;
+            ring_push(&pipe->filled, block);
+            return NULL;
+        }
+        block->len = n;
+        block->end = 0;
+        ring_push(&pipe->filled, block);
+    }
+}
+
+InputPipe *open_input_pipe(int fd)
+{
+    InputPipe *pipe = xcalloc(1, sizeof(InputPipe));
+    pipe->fd = fd;
+    pipe->blocks = xmalloc(INPUT_BLOCKS * sizeof(InputBlock));
+    ring_init(&pipe->filled, INPUT_BLOCKS);
+    ring_init(&pipe->empty, INPUT_BLOCKS);
+    for (int i = 0; i < INPUT_BLOCKS; i++)
+    {
+        ring_push(&pipe->empty, &pipe->blocks[i]);
+    }
+    if (pthread_create(&pipe->thread, NULL, reader_main, pipe) != 0)
+        fatal_error("Error: Could not start the reader thread");
+    return pipe;
+}
+
+size_t input_pipe_reader(char *buf, size_t max_size, void *arg)
+{
+    InputPipe *pipe = arg;
+    if (pipe->finished)
+        return 0;
+    if (pipe->current == NULL)
+    {
+        pipe->current = ring_pop(&pipe->filled);
+        pipe->offset = 0;
+        if (pipe->current->end)
+        {
+            pipe->finished = 1;
+            if (pipe->error)
+                fatal_error("Error: Could not read input: %s", strerror(pipe->error));
+            return 0;
+        }
+    }
+
+    size_t len = pipe->current->len - pipe->offset;
+    if (len > max_size)
+        len = max_size;
+    memcpy(buf, pipe->current->data + pipe->offset, len);
+    pipe->offset += len;
+    if (pipe->offset == pipe->current->len)
+    {
+        ring_push(&pipe->empty, pipe->current);
+        pipe->current = NULL;
+    }
+    return len;
+}
+
+void close_input_pipe(InputPipe *pipe)
+{
+    if (pipe == NULL)
+        return;
+    // A parser that stopped before the end leaves the reader blocked on a
+    // full queue or a read
+    if (!pipe->finished)
+        pthread_cancel(pipe->thread);
+    pthread_join(pipe->thread, NULL);
+
+    run_stats.pipeline.used = 1;
+    run_stats.pipeline.read_waits += pipe->empty.pop_waits;
+    run_stats.pipeline.parse_waits += pipe->filled.pop_waits;
+
+    ring_destroy(&pipe->filled);
+    ring_destroy(&pipe->empty);
+    xfree(pipe->blocks);
+    xfree(pipe);
+}
+
+// Output
+
+static void *writer_main(void *arg)
+{
+    OutputPipe *pipe = arg;
+    Sink *target = pipe->target;
+    int began = 0;  // The current table was opened
+    int failed = 0; // The current table failed; skip the rest of it
+    for (;;)
+    {
+        OutputChunk *chunk = ring_pop(&pipe->filled);
+        ChunkKind kind = chunk->kind;
+        switch (kind)
+        {
+        case CHUNK_BEGIN:
+            began = target->begin_table(target, chunk->data) == 0;
+            failed = !began;
+            break;
+        case CHUNK_WRITE:
+            if (!failed)
+                failed = target->write(target, chunk->data, chunk->len) != 0;
+            break;
+        case CHUNK_END:
+            // Like write_schema_to_sink, a table that failed to begin is not ended
+            if (!began || target->end_table(target) != 0 || failed)
+                pipe->status = -1;
+            began = 0;
+            break;
+        case CHUNK_STOP:
+            break;
+        }
+        ring_push(&pipe->empty, chunk);
+        if (kind == CHUNK_STOP)
+            return NULL;
+    }
+}
+
+static void send_chunk(OutputPipe *pipe, ChunkKind kind, const char *data, size_t len)
+{
+    OutputChunk *chunk = ring_pop(&pipe->empty);
+    chunk->kind = kind;
+    chunk->len = len;
+    if (len > 0)
+        memcpy(chunk->data, data, len);
+    ring_push(&pipe->filled, chunk);
+}
+
+static int pipe_begin_table(Sink *sink, const char *name)
+{
+    size_t len = strlen(name) + 1;
+    if (len > OUTPUT_CHUNK_SIZE)
+    {
+        fprintf(stderr, "Error: Table name too long: %.64s...\n", name);
+        return -1;
+    }
+    send_chunk((OutputPipe *)sink, CHUNK_BEGIN, name, len);
+    return 0;
+}
+
+static int pipe_write(Sink *sink, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t piece = len < OUTPUT_CHUNK_SIZE ? len : OUTPUT_CHUNK_SIZE;
+        send_chunk((OutputPipe *)sink, CHUNK_WRITE, data, piece);
+        data += piece;
+        len -= piece;
+    }
+    return 0;
+}
+
+static int pipe_end_table(Sink *sink)
+{
+    send_chunk((OutputPipe *)sink, CHUNK_END, NULL, 0);
+    return 0;
+}
+
+static void pipe_destroy(Sink *sink)
+{
+    (void)sink;
+}
+
+Sink *open_output_pipe(Sink *target)
+{
+    OutputPipe *pipe = xcalloc(1, sizeof(OutputPipe));
+    pipe->base.begin_table = pipe_begin_table;
+    pipe->base.write = pipe_write;
+    pipe->base.end_table = pipe_end_table;
+    pipe->base.destroy = pipe_destroy;
+    pipe->target = target;
+    pipe->chunks = xmalloc(OUTPUT_CHUNKS * sizeof(OutputChunk));
+    ring_init(&pipe->filled, OUTPUT_CHUNKS);
+    ring_init(&pipe->empty, OUTPUT_CHUNKS);
+    for (int i = 0; i < OUTPUT_CHUNKS; i++)
+    {
+        ring_push(&pipe->empty, &pipe->chunks[i]);
+    }
+    if (pthread_create(&pipe->thread, NULL, writer_main, pipe) != 0)
+        fatal_error("Error: Could not start the writer thread");
+    return &pipe->base;
+}
+
+int close_output_pipe(Sink *sink)
+{
+    OutputPipe *pipe = (OutputPipe *)sink;
+    send_chunk(pipe, CHUNK_STOP, NULL, 0);
+    pthread_join(pipe->thread, NULL);
+
+    run_stats.pipeline.used = 1;
+    run_stats.pipeline.format_waits += pipe->empty.pop_waits;
+    run_stats.pipeline.write_waits += pipe->filled.pop_waits;
+
+    int status = pipe->status;
+    ring_destroy(&pipe->filled);
+    ring_destroy(&pipe->empty);
+    xfree(pipe->chunks);
+    xfree(pipe);
+    return status;
+}
@@ -0,0 +1,37 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include "sink.h"
+
+// Threads that overlap the converter's I/O with its CPU work:
+//
+//   reader --blocks--> lex/parse, tape, schema, populate, format --chunks--> writer
+//
+// A reader thread prefetches the input and a writer thread performs the
+// output, each connected to the converting thread by a bounded queue of
+// fixed buffers, so a stage that runs ahead blocks instead of buffering
+// without limit. Parsing, population and formatting stay on one thread:
+// population needs the schema of the whole document, and the scanner and
+// parser are not reentrant.
+
+typedef struct InputPipe InputPipe;
+
+// Start reading fd on a reader thread
+InputPipe *open_input_pipe(int fd);
+
+// ScannerReader over an input pipe: copy up to max_size bytes of input to
+// buf, returning 0 at the end of the input
+size_t input_pipe_reader(char *buf, size_t max_size, void *pipe);
+
+// Stop the reader, which has normally reached the end, and free the pipe
+void close_input_pipe(InputPipe *pipe);
+
+// A sink that hands every table to target on a writer thread
+Sink *open_output_pipe(Sink *target);
+
+// Wait for the writer to finish and free the pipe, but not its target.
+// Returns -1 if any operation on the target failed.
+int close_output_pipe(Sink *pipe);
+
+#endif // PIPELINE_H
@@ -2,14 +2,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "schema.h"
+#include "stats.h"
+#include "alloc.h"
+#include "fatal.h"
+#include "parallel.h"
 
 // Schema operations
 Schema *create_schema()
 {
-    Schema *schema = malloc(sizeof(Schema));
+    Schema *schema = xmalloc(sizeof(Schema));
     schema->tables = NULL;
+    schema->last_table = NULL;
     schema->table_count = 0;
+    schema->tables_by_name = NULL;
+    schema->tables_by_name_capacity = 0;
+    schema->shapes = create_shape_cache();
+    schema->stack = (TraversalStack){0};
     return schema;
 }
 
@@ -25,7 +37,10 @@ void free_schema(Schema *schema)
         free_table(table);
         table = next;
     }
-    free(schema);
+    free_shape_cache(schema->shapes);
+    stack_free(&schema->stack);
+    xfree(schema->tables_by_name);
+    xfree(schema);
 }
 
 void add_table(Schema *schema, Table *table)
@@ -40,14 +55,29 @@ void add_table(Schema *schema, Table *table)
     }
     else
     {
-        Table *current = schema->tables;
-        while (current->next != NULL)
+        schema->last_table->next = table;
+    }
+    schema->last_table = table;
+    schema->table_count++;
+
+    int id = atom_id(table->name);
+    if (id >= schema->tables_by_name_capacity)
+    {
+        int new_capacity = schema->tables_by_name_capacity ? schema->tables_by_name_capacity : 64;
+        while (new_capacity <= id)
         {
-            current = current->next;
+            new_capacity *= 2;
         }
-        current->next = table;
+        schema->tables_by_name = xrealloc(schema->tables_by_name, new_capacity * sizeof(Table *));
+        memset(schema->tables_by_name + schema->tables_by_name_capacity, 0,
+               (new_capacity - schema->tables_by_name_capacity) * sizeof(Table *));
+        schema->tables_by_name_capacity = new_capacity;
+    }
+    // Keep the first table of a name, as the list walk used to find
+    if (schema->tables_by_name[id] == NULL)
+    {
+        schema->tables_by_name[id] = table;
     }
-    schema->table_count++;
 }
 
 Table *find_table(Schema *schema, const char *name)
@@ -55,46 +85,148 @@ Table *find_table(Schema *schema, const char *name)
     if (schema == NULL || name == NULL)
         return NULL;
 
-    Table *table = schema->tables;
-    while (table != NULL)
-    {
-        if (strcmp(table->name, name) == 0)
-        {
-            return table;
-        }
-        table = table->next;
-    }
-    return NULL;
+    // Table names are interned, so a name that was never interned cannot match
+    Atom atom = intern_lookup(name);
+    if (atom == NULL)
+        return NULL;
+
+    int id = atom_id(atom);
+    return id < schema->tables_by_name_capacity ? schema->tables_by_name[id] : NULL;
 }
 
 // Table operations
 Table *create_table(const char *name)
 {
-    Table *table = malloc(sizeof(Table));
-    table->name = strdup(name);
+    Table *table = xmalloc(sizeof(Table));
+    table->name = intern_string(name);
     table->columns = NULL;
+    table->last_column = NULL;
+    table->column_count = 0;
+    table->column_index = (ColumnIndex){0};
+    table->column_slots = NULL;
+    table->column_slot_capacity = 0;
     table->rows = NULL;
+    table->last_row = NULL;
     table->next = NULL;
     table->row_count = 0;
+    table->next_id = 0;
+
+    table->plan.parent = NULL;
+    table->plan.fk_name = NULL;
+    table->plan.column_count = 0;
+    table->plan.id_slot = -1;
+    table->plan.fk_slot = -1;
+    table->plan.value_slot = -1;
 
     // Always add an 'id' column as primary key
-    add_column(table, "id", "INTEGER");
+    add_column(table, "id", TYPE_INTEGER);
 
     return table;
 }
 
+// Create a table whose rows reference parent through a <parent>_id column
+Table *create_child_table(Schema *schema, const char *name, Table *parent)
+{
+    Table *table = create_table(name);
+    add_table(schema, table);
+
+    char *parent_fk_name = xmalloc(strlen(parent->name) + 4); // +4 for "_id\0"
+    sprintf(parent_fk_name, "%s_id", parent->name);
+    add_column(table, parent_fk_name, TYPE_INTEGER); // Foreign key to parent
+
+    table->plan.parent = parent;
+    table->plan.fk_name = intern_string(parent_fk_name);
+    xfree(parent_fk_name);
+    return table;
+}
+
+// Resolve the column slots of every table once the schema is complete
+void build_table_plans(Schema *schema)
+{
+    for (Table *table = schema->tables; table != NULL; table = table->next)
+    {
+        TablePlan *plan = &table->plan;
+        plan->column_count = get_column_count(table);
+        plan->id_slot = find_column_index(table, "id");
+        plan->fk_slot = find_column_slot(table, plan->fk_name);
+        plan->value_slot = find_column_index(table, "value");
+    }
+}
+
+// Values
+
+ColumnType widen_type(ColumnType a, ColumnType b)
+{
+    return a > b ? a : b;
+}
+
+const char *column_type_name(ColumnType type)
+{
+    static const char *names[] = {"NULL", "BOOLEAN", "INTEGER", "REAL", "TEXT"};
+    return names[type];
+}
+
+// Free the text of value, if any, and leave it empty
+static void clear_value(Value *value)
+{
+    if (value->kind == VALUE_TEXT)
+        xfree(value->as.text);
+    value->kind = VALUE_EMPTY;
+}
+
+// Digits of number into buffer, without going through printf
+static const char *format_integer(long long number, char *buffer)
+{
+    char *end = buffer + VALUE_BUFFER_SIZE - 1;
+    char *p = end;
+    unsigned long long magnitude = number < 0 ? 0ull - (unsigned long long)number : (unsigned long long)number;
+    *p = '\0';
+    do
+    {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (number < 0)
+        *--p = '-';
+    return p;
+}
+
+// The CSV text of value. Numbers are formatted into buffer, which must
+// hold VALUE_BUFFER_SIZE bytes.
+const char *format_value(const Value *value, char *buffer)
+{
+    switch (value->kind)
+    {
+    case VALUE_EMPTY:
+    case VALUE_NULL:
+        return "";
+    case VALUE_BOOLEAN:
+        return value->as.boolean ? "true" : "false";
+    case VALUE_INTEGER:
+        return format_integer(value->as.integer, buffer);
+    case VALUE_REAL:
+        snprintf(buffer, VALUE_BUFFER_SIZE, "%g", value->as.real);
+        return buffer;
+    case VALUE_TEXT:
+        return value->as.text;
+    default:
+        return "complex_value";
+    }
+}
+
 void free_table(Table *table)
 {
     if (table == NULL)
         return;
 
+    // Count the columns before they are freed, rows are sized by it
+    int col_count = get_column_count(table);
+
     Column *column = table->columns;
     while (column != NULL)
     {
         Column *next = column->next;
-        free(column->name);
-        free(column->type);
-        free(column);
+        xfree(column);
         column = next;
     }
 
@@ -103,51 +235,92 @@ void free_table(Table *table)
     while (row != NULL)
     {
         Row *next_row = row->next;
-        int col_count = get_column_count(table);
         for (int i = 0; i < col_count; i++)
         {
-            free(row->values[i]);
+            clear_value(&row->values[i]);
         }
-        free(row->values);
-        free(row);
+        xfree(row->values);
+        xfree(row);
         row = next_row;
     }
 
-    free(table->name);
-    free(table);
+    xfree(table->column_index.names);
+    xfree(table->column_index.slots);
+    xfree(table->column_slots);
+    xfree(table);
 }
 
-void add_column(Table *table, const char *name, const char *type)
+static unsigned int column_hash(Atom name)
 {
-    if (table == NULL || name == NULL || type == NULL)
-        return;
+    return (unsigned int)atom_id(name) * 2654435761u;
+}
 
-    // Debug output
-    fprintf(stderr, "Adding column '%s' of type '%s' to table '%s'\n", name, type, table->name);
+// Slot of the column called name, or -1
+static int column_index_find(const ColumnIndex *index, Atom name)
+{
+    if (index->capacity == 0)
+        return -1;
 
-    // Check if column already exists
-    Column *existing = table->columns;
-    while (existing != NULL)
+    int i = column_hash(name) & (index->capacity - 1);
+    while (index->names[i] != NULL)
+    {
+        if (index->names[i] == name)
+            return index->slots[i];
+        i = (i + 1) & (index->capacity - 1);
+    }
+    return -1;
+}
+
+static void column_index_insert(ColumnIndex *index, Atom name, int slot)
+{
+    // Keep the load factor at or below one half
+    if ((slot + 1) * 2 > index->capacity)
     {
-        if (strcmp(existing->name, name) == 0)
+        ColumnIndex old = *index;
+        index->capacity = old.capacity ? old.capacity * 2 : 16;
+        index->names = xcalloc(index->capacity, sizeof(Atom));
+        index->slots = xmalloc(index->capacity * sizeof(int));
+        for (int i = 0; i < old.capacity; i++)
         {
-            // Column already exists
-            fprintf(stderr, "Column '%s' already exists in table '%s', skipping\n", name, table->name);
-            return;
+            if (old.names[i] != NULL)
+                column_index_insert(index, old.names[i], old.slots[i]);
         }
-        existing = existing->next;
+        xfree(old.names);
+        xfree(old.slots);
     }
 
-    // Create new column
-    Column *column = malloc(sizeof(Column));
-    if (!column)
+    int i = column_hash(name) & (index->capacity - 1);
+    while (index->names[i] != NULL)
     {
-        fprintf(stderr, "Memory allocation failed for column\n");
-        return;
+        i = (i + 1) & (index->capacity - 1);
+    }
+    index->names[i] = name;
+    index->slots[i] = slot;
+}
+
+// Widen the type of the column in slot to cover type
+static void widen_column(Table *table, int slot, ColumnType type)
+{
+    Column *column = table->column_slots[slot];
+    column->type = widen_type(column->type, type);
+}
+
+// Append a column unless the table has one called name, whose type is
+// widened instead; returns 0 if it already exists
+static int insert_column(Table *table, Atom name, ColumnType type)
+{
+    int slot = column_index_find(&table->column_index, name);
+    if (slot >= 0)
+    {
+        widen_column(table, slot, type);
+        return 0;
     }
 
-    column->name = strdup(name);
-    column->type = strdup(type);
+    // Create new column
+    Column *column = xmalloc(sizeof(Column));
+
+    column->name = name;
+    column->type = type;
     column->next = NULL;
 
     // Add column at the end of the list to maintain insertion order
@@ -157,15 +330,42 @@ void add_column(Table *table, const char *name, const char *type)
     }
     else
     {
-        Column *current = table->columns;
-        while (current->next != NULL)
-        {
-            current = current->next;
-        }
-        current->next = column;
+        table->last_column->next = column;
+    }
+    table->last_column = column;
+    if (table->column_count == table->column_slot_capacity)
+    {
+        table->column_slot_capacity = table->column_slot_capacity ? table->column_slot_capacity * 2 : 16;
+        table->column_slots = xrealloc(table->column_slots, table->column_slot_capacity * sizeof(Column *));
+    }
+    table->column_slots[table->column_count] = column;
+    column_index_insert(&table->column_index, name, table->column_count);
+    table->column_count++;
+    return 1;
+}
+
+void add_column(Table *table, const char *name, ColumnType type)
+{
+    if (table == NULL || name == NULL)
+        return;
+
+    // Debug output
+    fprintf(stderr, "Adding column '%s' of type '%s' to table '%s'\n", name, column_type_name(type),
+            table->name);
+
+    Atom atom = intern_string(name);
+
+    // Check if column already exists
+    int slot = column_index_find(&table->column_index, atom);
+    if (slot >= 0)
+    {
+        widen_column(table, slot, type);
+        fprintf(stderr, "Column '%s' already exists in table '%s', skipping\n", name, table->name);
+        return;
     }
 
-    fprintf(stderr, "Successfully added column '%s' to table '%s'\n", name, table->name);
+    if (insert_column(table, atom, type))
+        fprintf(stderr, "Successfully added column '%s' to table '%s'\n", name, table->name);
 }
 
 int get_column_count(Table *table)
@@ -173,13 +373,7 @@ int get_column_count(Table *table)
     if (table == NULL)
         return 0;
 
-    int count = 0;
-    Column *column = table->columns;
-    while (column != NULL)
-    {
-        count++;
-        column = column->next;
-    }
+    int count = table->column_count;
     fprintf(stderr, "Table '%s' has %d columns\n", table->name, count);
     return count;
 }
@@ -199,14 +393,14 @@ void debug_print_table(Table *table)
     int count = 0;
     while (col)
     {
-        fprintf(stderr, "    %d. %s (%s)\n", ++count, col->name, col->type);
+        fprintf(stderr, "    %d. %s (%s)\n", ++count, col->name, column_type_name(col->type));
         col = col->next;
     }
 
     fprintf(stderr, "  Total columns: %d\n", count);
 }
 
-void add_row(Table *table, char **values)
+void add_row(Table *table, Value *values)
 {
     if (!table)
     {
@@ -214,24 +408,8 @@ void add_row(Table *table, char **values)
         return;
     }
 
-    Row *row = malloc(sizeof(Row));
-    if (!row)
-    {
-        fprintf(stderr, "Memory allocation failed for row\n");
-        // Free the values that were passed in, as we won't be using them
-        int col_count = get_column_count(table);
-        for (int i = 0; i < col_count; i++)
-        {
-            if (values[i])
-            {
-                free(values[i]);
-            }
-        }
-        free(values);
-        return;
-    }
-
-    row->values = values; // Array of strings for the row's values
+    Row *row = xmalloc(sizeof(Row));
+    row->values = values; // One cell per column
     row->next = NULL;
 
     // Add row at the end of the list to maintain insertion order
@@ -241,47 +419,75 @@ void add_row(Table *table, char **values)
     }
     else
     {
-        Row *current = table->rows;
-        while (current->next != NULL)
-        {
-            current = current->next;
-        }
-        current->next = row;
+        table->last_row->next = row;
     }
+    table->last_row = row;
     table->row_count++;
 
     fprintf(stderr, "Successfully added row to table '%s', now has %d rows\n",
             table->name, table->row_count);
 }
 
+// Hand out count consecutive ids of table, returning the first. Each
+// table numbers its rows 1, 2, ... in the order they are allocated.
+int allocate_ids(Table *table, int count)
+{
+    int first = table->next_id + 1;
+    table->next_id += count;
+    return first;
+}
+
 Column *find_column(Table *table, const char *name)
 {
     if (table == NULL || name == NULL)
         return NULL;
 
+    Atom atom = intern_lookup(name);
+    if (atom == NULL || column_index_find(&table->column_index, atom) < 0)
+        return NULL;
+
     Column *column = table->columns;
-    while (column != NULL)
+    while (column != NULL && column->name != atom)
     {
-        if (strcmp(column->name, name) == 0)
-        {
-            return column;
-        }
         column = column->next;
     }
-    return NULL;
+    return column;
 }
 
-// Helper function to convert a string to a valid table name
-char *to_table_name(const char *str)
+// Normalized table names, indexed by the atom id of the raw key. A second
+// index maps each normalized name back to the first raw key that produced
+// it, so two keys collapsing onto one table are reported once.
+static Atom *table_name_cache = NULL;
+static Atom *table_name_owner = NULL;
+static int table_name_capacity = 0;
+
+static void reserve_table_names(int id)
 {
-    if (str == NULL)
-        return NULL;
+    if (id < table_name_capacity)
+        return;
+
+    int new_capacity = table_name_capacity ? table_name_capacity : 64;
+    while (new_capacity <= id)
+    {
+        new_capacity *= 2;
+    }
 
-    char *result = malloc(strlen(str) + 1);
+    table_name_cache = xrealloc(table_name_cache, new_capacity * sizeof(Atom));
+    table_name_owner = xrealloc(table_name_owner, new_capacity * sizeof(Atom));
+    memset(table_name_cache + table_name_capacity, 0, (new_capacity - table_name_capacity) * sizeof(Atom));
+    memset(table_name_owner + table_name_capacity, 0, (new_capacity - table_name_capacity) * sizeof(Atom));
+    table_name_capacity = new_capacity;
+}
+
+static Atom normalize_table_name(Atom key)
+{
+    size_t len = strlen(key);
+    char stack_buffer[128];
+    char *result = len < sizeof(stack_buffer) ? stack_buffer : xmalloc(len + 1);
     int j = 0;
-    for (int i = 0; str[i] != '\0'; i++)
+    for (int i = 0; key[i] != '\0'; i++)
     {
-        unsigned char c = str[i];
+        unsigned char c = key[i];
         if (isalnum(c))
         {
             result[j++] = tolower(c);
@@ -292,7 +498,57 @@ char *to_table_name(const char *str)
         }
     }
     result[j] = '\0';
-    return result;
+    Atom name = intern_string_len(result, j);
+    if (result != stack_buffer)
+        xfree(result);
+    return name;
+}
+
+// Normalized table name for an interned key. Names are computed once per
+// distinct key and returned without allocating.
+Atom table_name_of(Atom key)
+{
+    if (key == NULL)
+        return NULL;
+
+    int id = atom_id(key);
+    if (id < table_name_capacity && table_name_cache[id] != NULL)
+        return table_name_cache[id];
+
+    Atom name = normalize_table_name(key);
+
+    // Interning the name may have added atoms, so reserve for both ids
+    int name_id = atom_id(name);
+    reserve_table_names(id > name_id ? id : name_id);
+    table_name_cache[id] = name;
+
+    if (table_name_owner[name_id] == NULL)
+    {
+        table_name_owner[name_id] = key;
+    }
+    else if (table_name_owner[name_id] != key)
+    {
+        fprintf(stderr, "Warning: keys '%s' and '%s' both map to table '%s'\n",
+                table_name_owner[name_id], key, name);
+    }
+    return name;
+}
+
+// Helper function to convert a string to a valid table name
+Atom to_table_name(const char *str)
+{
+    if (str == NULL)
+        return NULL;
+    return table_name_of(intern_string(str));
+}
+
+void free_table_name_cache(void)
+{
+    xfree(table_name_cache);
+    xfree(table_name_owner);
+    table_name_cache = NULL;
+    table_name_owner = NULL;
+    table_name_capacity = 0;
 }
 
 // Convert node value to string
@@ -300,7 +556,7 @@ char *node_to_string(Node *node)
 {
     if (node == NULL)
     {
-        return strdup("NULL");
+        return xstrdup("NULL");
     }
 
     char buffer[256];
@@ -308,22 +564,22 @@ char *node_to_string(Node *node)
     switch (node->type)
     {
     case NODE_STRING:
-        return strdup(node->value.str);
+        return xstrdup(node->value.str);
     case NODE_NUMBER:
-        snprintf(buffer, sizeof(buffer), "%g", node->value.num);
-        return strdup(buffer);
+        snprintf(buffer, sizeof(buffer), "%g", strtod(node->value.number, NULL));
+        return xstrdup(buffer);
     case NODE_BOOLEAN:
-        return strdup(node->value.boolean ? "true" : "false");
+        return xstrdup(node->value.boolean ? "true" : "false");
     case NODE_NULL:
-        return strdup("null");
+        return xstrdup("null");
     default:
-        return strdup("complex_value");
+        return xstrdup("complex_value");
     }
 }
 
 // Forward declarations
-void generate_schema_from_node(Node *node, Schema *schema, const char *parent_table);
-void populate_data_from_node(Node *node, Schema *schema, const char *parent_table, int parent_id, int id);
+void generate_schema_from_tape(Tape *tape, Schema *schema);
+void populate_data_from_tape(Tape *tape, Schema *schema);
 
 // Schema generation
 void process_ast(Node *root, const char *out_dir)
@@ -331,10 +587,22 @@ void process_ast(Node *root, const char *out_dir)
     if (root == NULL)
         return;
 
+    Tape *tape = tape_from_ast(root);
+    process_tape(tape, out_dir);
+    free_tape(tape);
+}
+
+// Build and populate the schema for a tape. The caller writes and frees it.
+Schema *convert_tape(Tape *tape)
+{
+    if (tape == NULL || tape->count == 0)
+        return NULL;
+
     Schema *schema = create_schema();
 
     // First pass: Generate schema structure
-    generate_schema_from_node(root, schema, NULL);
+    stats_begin(PHASE_SCHEMA);
+    generate_schema_from_tape(tape, schema);
 
     // Debug output
     fprintf(stderr, "Schema structure after generation:\n");
@@ -346,727 +614,1290 @@ void process_ast(Node *root, const char *out_dir)
         Column *debug_col = debug_table->columns;
         while (debug_col != NULL)
         {
-            fprintf(stderr, "%s (%s), ", debug_col->name, debug_col->type);
+            fprintf(stderr, "%s (%s), ", debug_col->name, column_type_name(debug_col->type));
             debug_col = debug_col->next;
         }
         fprintf(stderr, "\n");
         debug_table = debug_table->next;
     }
 
+    build_table_plans(schema);
+    stats_end(PHASE_SCHEMA);
+
     // Second pass: Populate data
-    populate_data_from_node(root, schema, NULL, -1, 1);
+    stats_begin(PHASE_POPULATE);
+    populate_data_from_tape(tape, schema);
+    stats_end(PHASE_POPULATE);
 
-    write_schema_to_csv(schema, out_dir);
-    free_schema(schema);
+    stats_record_tables(schema);
+    return schema;
 }
 
-void generate_schema_from_node(Node *node, Schema *schema, const char *parent_table)
+void process_tape(Tape *tape, const char *out_dir)
 {
-    if (node == NULL || schema == NULL)
+    Schema *schema = convert_tape(tape);
+    if (schema == NULL)
         return;
 
-    switch (node->type)
+    write_schema_to_csv(schema, out_dir);
+    write_schema_sidecar(schema, out_dir);
+    free_schema(schema);
+}
+
+// Type of the value at index of tape; nested objects and arrays are stored
+// as text
+static ColumnType column_type_of(const Tape *tape, size_t index)
+{
+    switch (tape_type(tape, index))
     {
-    case NODE_OBJECT:
+    case TAPE_NUMBER:
     {
-        // Create a new table for this object
-        char *table_name = to_table_name(parent_table ? parent_table : "root");
-        fprintf(stderr, "Creating/finding table: %s\n", table_name);
-
-        Table *table = find_table(schema, table_name);
-        if (table == NULL)
-        {
-            table = create_table(table_name);
-            add_table(schema, table);
-            fprintf(stderr, "Created new table: %s\n", table_name);
+        // An integer too long for 64 bits keeps its literal as TEXT rather
+        // than lose digits as a REAL
+        long long integer;
+        if (tape_integer(tape, index, &integer))
+            return TYPE_INTEGER;
+        return strpbrk(tape_number_text(tape, index), ".eE") ? TYPE_REAL : TYPE_TEXT;
+    }
+    case TAPE_TRUE:
+    case TAPE_FALSE:
+        return TYPE_BOOLEAN;
+    case TAPE_NULL:
+        return TYPE_NULL;
+    default:
+        return TYPE_TEXT;
+    }
+}
 
-            // If this is a child table, add parent_id column for relationship
-            if (parent_table != NULL)
-            {
-                char *parent_table_name = to_table_name(parent_table);
-                char *parent_fk_name = malloc(strlen(parent_table_name) + 4); // +4 for "_id\0"
-                sprintf(parent_fk_name, "%s_id", parent_table_name);
-                add_column(table, parent_fk_name, "INTEGER"); // Foreign key to parent
-                free(parent_fk_name);
-                free(parent_table_name);
-            }
-        }
+// Widen the column called name, if the table has one
+static void widen_named_column(Table *table, Atom name, ColumnType type)
+{
+    int slot = column_index_find(&table->column_index, name);
+    if (slot >= 0)
+        widen_column(table, slot, type);
+}
 
-        // Process each key-value pair in the object
-        Pair *pair = node->value.pairs;
-        while (pair != NULL)
+// Add the columns of the array at index to array_table: the keys of its
+// objects, or a value column for the first element that is not an object.
+// Columns stop being added there, but every later value that lands in a
+// column still widens its type.
+static void infer_array(Tape *tape, size_t index, Table *array_table)
+{
+    int stopped = 0;
+    size_t end = tape_end(tape, index);
+    for (size_t element = index + 1; element < end; element = tape_next(tape, element))
+    {
+        if (tape_type(tape, element) == TAPE_OBJECT_START)
         {
-            fprintf(stderr, "Processing key: %s\n", pair->key);
-
-            if (pair->value->type == NODE_OBJECT)
-            {
-                // Nested object - create a new table with relationship
-                char *child_table_name = to_table_name(pair->key);
-                Table *child_table = find_table(schema, child_table_name);
-
-                if (child_table == NULL)
-                {
-                    child_table = create_table(child_table_name);
-                    add_table(schema, child_table);
-
-                    // Add foreign key to parent table
-                    char *parent_fk_name = malloc(strlen(table_name) + 4);
-                    sprintf(parent_fk_name, "%s_id", table_name);
-                    add_column(child_table, parent_fk_name, "INTEGER");
-                    free(parent_fk_name);
-                }
-
-                // Create the nested table
-                generate_schema_from_node(pair->value, schema, pair->key);
-                free(child_table_name);
-            }
-            else if (pair->value->type == NODE_ARRAY)
-            {
-                // Create a new table for this array
-                char *array_table_name = to_table_name(pair->key);
-                Table *array_table = find_table(schema, array_table_name);
-
-                if (array_table == NULL)
-                {
-                    array_table = create_table(array_table_name);
-                    add_table(schema, array_table);
-
-                    // Add foreign key to parent table
-                    char *parent_fk_name = malloc(strlen(table_name) + 4);
-                    sprintf(parent_fk_name, "%s_id", table_name);
-                    add_column(array_table, parent_fk_name, "INTEGER");
-                    free(parent_fk_name);
-                }
-
-                // Process array elements to determine columns
-                Element *element = pair->value->value.elements;
-                int element_index = 0;
-
-                while (element != NULL)
-                {
-                    if (element->value->type == NODE_OBJECT)
-                    {
-                        // If array contains objects, add their fields as columns
-                        Pair *obj_pair = element->value->value.pairs;
-                        while (obj_pair != NULL)
-                        {
-                            const char *type = "TEXT";
-                            if (obj_pair->value->type == NODE_NUMBER)
-                                type = "REAL";
-                            else if (obj_pair->value->type == NODE_BOOLEAN)
-                                type = "INTEGER";
-
-                            add_column(array_table, obj_pair->key, type);
-                            obj_pair = obj_pair->next;
-                        }
-                    }
-                    else
-                    {
-                        // If array contains primitives, add a value column
-                        const char *type = "TEXT";
-                        if (element->value->type == NODE_NUMBER)
-                            type = "REAL";
-                        else if (element->value->type == NODE_BOOLEAN)
-                            type = "INTEGER";
-
-                        add_column(array_table, "value", type);
-                        break; // Only need to add this column once
-                    }
-
-                    element = element->next;
-                    element_index++;
-                }
-
-                free(array_table_name);
-            }
-            else
+            // If array contains objects, add their fields as columns
+            size_t obj_end = tape_end(tape, element);
+            for (size_t obj_key = element + 1; obj_key < obj_end; obj_key = tape_next(tape, obj_key + 1))
             {
-                // Regular scalar value - add as column
-                const char *type = "TEXT";
-                if (pair->value->type == NODE_NUMBER)
-                {
-                    type = "REAL";
-                    fprintf(stderr, "Adding NUMBER column: %s as %s\n", pair->key, type);
-                }
-                else if (pair->value->type == NODE_BOOLEAN)
-                {
-                    type = "INTEGER";
-                    fprintf(stderr, "Adding BOOLEAN column: %s as %s\n", pair->key, type);
-                }
+                if (stopped)
+                    widen_named_column(array_table, tape_key(tape, obj_key), column_type_of(tape, obj_key + 1));
                 else
-                {
-                    fprintf(stderr, "Adding TEXT column: %s as %s\n", pair->key, type);
-                }
-
-                fprintf(stderr, "About to add column '%s' to table '%s'\n", pair->key, table->name);
-                add_column(table, pair->key, type);
+                    add_column(array_table, tape_key(tape, obj_key), column_type_of(tape, obj_key + 1));
             }
-
-            pair = pair->next;
         }
-
-        free(table_name);
-        break;
-    }
-
-    case NODE_ARRAY:
-        // Arrays are handled within the object case
-        break;
-
-    default:
-        break;
+        else if (stopped)
+        {
+            widen_named_column(array_table, intern_string("value"), column_type_of(tape, element));
+        }
+        else
+        {
+            // If array contains primitives, add a value column
+            add_column(array_table, "value", column_type_of(tape, element));
+            stopped = 1; // Only need to add this column once
+        }
     }
 }
 
-// Helper function to find column index by name
-int find_column_index(Table *table, const char *column_name)
+// Large arrays are inferred in chunks on the thread pool. Each chunk
+// builds a partial schema: the columns its elements name, in first-seen
+// order, with the join of their values' types. Partials merge by ordered
+// union, joining the types of names in both; that is associative, so
+// merging the chunks in order gives the columns, order and types of a
+// single pass however the elements were cut. A wave of chunks runs at a
+// time and its partials are merged into the table. The per-column log of
+// the serial pass is not written; each array gets one summary line.
+#define SCHEMA_CHUNK_ELEMENTS 1024
+#define SCHEMA_CHUNKS_PER_THREAD 4
+
+typedef struct PartialColumn
 {
-    if (!table || !column_name)
-        return -1;
-
-    int index = 0;
-    Column *col = table->columns;
+    Atom name;
+    ColumnType type;
+    int before_stop; // First seen before the chunk's stop element
+} PartialColumn;
 
-    while (col)
-    {
-        if (strcmp(col->name, column_name) == 0)
-            return index;
-        col = col->next;
-        index++;
-    }
+typedef struct PartialSchema
+{
+    PartialColumn *columns;
+    int count;
+    int capacity;
+    ColumnIndex index; // Name to position in columns
+    size_t stop;       // Element that is not an object, 0 if none
+} PartialSchema;
+
+typedef struct SchemaChunk
+{
+    size_t first; // Tape index of the first element
+    int count;    // Elements
+    PartialSchema partial;
+} SchemaChunk;
 
-    return -1;
-}
+typedef struct ArrayInference
+{
+    Tape *tape;
+    Table *array_table;
+    Atom value_name;
+    SchemaChunk *chunks;
+} ArrayInference;
 
-void populate_data_from_node(Node *node, Schema *schema, const char *parent_table, int parent_id, int id)
+static void partial_add(PartialSchema *partial, Atom name, ColumnType type)
 {
-    if (node == NULL || schema == NULL)
+    int position = column_index_find(&partial->index, name);
+    if (position >= 0)
     {
-        fprintf(stderr, "Warning: NULL node or schema in populate_data_from_node\n");
+        PartialColumn *column = &partial->columns[position];
+        column->type = widen_type(column->type, type);
         return;
     }
-
-    switch (node->type)
+    if (partial->count == partial->capacity)
     {
-    case NODE_OBJECT:
-    {
-        char *table_name = to_table_name(parent_table ? parent_table : "root");
-        if (!table_name)
-        {
-            fprintf(stderr, "Error: Failed to create table name\n");
-            return;
-        }
+        partial->capacity = partial->capacity ? partial->capacity * 2 : 16;
+        partial->columns = xrealloc(partial->columns, partial->capacity * sizeof(PartialColumn));
+    }
+    partial->columns[partial->count] = (PartialColumn){name, type, partial->stop == 0};
+    column_index_insert(&partial->index, name, partial->count);
+    partial->count++;
+}
+
+static void free_partial(PartialSchema *partial)
+{
+    xfree(partial->columns);
+    xfree(partial->index.names);
+    xfree(partial->index.slots);
+}
 
-        Table *table = find_table(schema, table_name);
-        if (!table)
+static void infer_chunk(int index, void *arg)
+{
+    ArrayInference *array = arg;
+    SchemaChunk *chunk = &array->chunks[index];
+    const Tape *tape = array->tape;
+    size_t element = chunk->first;
+    for (int k = 0; k < chunk->count; k++, element = tape_next(tape, element))
+    {
+        if (tape_type(tape, element) != TAPE_OBJECT_START)
         {
-            fprintf(stderr, "Error: Table '%s' not found\n", table_name);
-            free(table_name);
-            return;
+            partial_add(&chunk->partial, array->value_name, column_type_of(tape, element));
+            if (chunk->partial.stop == 0)
+                chunk->partial.stop = element;
+            continue;
         }
-
-        // Count columns
-        int col_count = get_column_count(table);
-        fprintf(stderr, "Table '%s' has %d columns\n", table_name, col_count);
-
-        // Allocate space for values
-        char **values = malloc(col_count * sizeof(char *));
-        if (!values)
+        size_t obj_end = tape_end(tape, element);
+        for (size_t obj_key = element + 1; obj_key < obj_end; obj_key = tape_next(tape, obj_key + 1))
         {
-            fprintf(stderr, "Error: Failed to allocate memory for row values\n");
-            free(table_name);
-            return;
+            partial_add(&chunk->partial, tape_key(tape, obj_key), column_type_of(tape, obj_key + 1));
         }
+    }
+}
 
-        for (int i = 0; i < col_count; i++)
+static void infer_array_parallel(Tape *tape, size_t index, Table *array_table)
+{
+    int wave = pool_size() * SCHEMA_CHUNKS_PER_THREAD;
+    SchemaChunk *chunks = xcalloc(wave, sizeof(SchemaChunk));
+    ArrayInference array = {tape, array_table, intern_string("value"), chunks};
+
+    size_t element = index + 1;
+    size_t end = tape_end(tape, index);
+    int stopped = 0;
+    while (element < end)
+    {
+        int count = 0;
+        for (; count < wave && element < end; count++)
         {
-            values[i] = strdup("");
-            if (!values[i])
+            SchemaChunk *chunk = &chunks[count];
+            chunk->first = element;
+            chunk->count = 0;
+            while (element < end && chunk->count < SCHEMA_CHUNK_ELEMENTS)
             {
-                fprintf(stderr, "Error: Failed to allocate memory for value\n");
-                // Clean up already allocated values
-                for (int j = 0; j < i; j++)
-                {
-                    free(values[j]);
-                }
-                free(values);
-                free(table_name);
-                return;
+                element = tape_next(tape, element);
+                chunk->count++;
             }
         }
+        parallel_for(count, infer_chunk, &array);
 
-        // Set the ID value
-        char id_str[32];
-        snprintf(id_str, sizeof(id_str), "%d", id);
-
-        int id_index = find_column_index(table, "id");
-        if (id_index >= 0 && id_index < col_count)
+        // Merge in chunk order. A single pass adds no columns after the
+        // first element that is not an object, but the values after it
+        // still widen the columns they land in.
+        for (int c = 0; c < count; c++)
         {
-            free(values[id_index]);
-            values[id_index] = strdup(id_str);
-            if (!values[id_index])
+            PartialSchema *partial = &chunks[c].partial;
+            for (int k = 0; k < partial->count; k++)
             {
-                fprintf(stderr, "Error: Failed to allocate memory for ID value\n");
-                for (int i = 0; i < col_count; i++)
-                {
-                    free(values[i]);
-                }
-                free(values);
-                free(table_name);
-                return;
+                PartialColumn *column = &partial->columns[k];
+                if (!stopped && column->before_stop)
+                    insert_column(array_table, column->name, column->type);
+                else
+                    widen_named_column(array_table, column->name, column->type);
             }
-            fprintf(stderr, "Set ID column to %s\n", id_str);
+            if (!stopped)
+                stopped = partial->stop != 0;
+            free_partial(partial);
+            memset(partial, 0, sizeof(PartialSchema));
         }
+    }
+    xfree(chunks);
+    fprintf(stderr, "Inferred the columns of table '%s' from %d elements on %d threads\n",
+            array_table->name, tape_child_count(tape, index), pool_size());
+}
 
-        // Handle parent ID reference if applicable
-        if (parent_id >= 0 && parent_table && strcmp(parent_table, "root") != 0)
-        {
-            char *parent_table_name = to_table_name("root");
-            if (!parent_table_name)
-            {
-                fprintf(stderr, "Error: Failed to create parent table name\n");
-                for (int i = 0; i < col_count; i++)
-                {
-                    free(values[i]);
-                }
-                free(values);
-                free(table_name);
-                return;
-            }
+// Walk the tape in document order. Every object is entered before the
+// remaining keys of its parent, so tables and columns are created in the
+// same order as a depth-first walk of the AST. The stack holds the table of
+// each open object.
+void generate_schema_from_tape(Tape *tape, Schema *schema)
+{
+    if (tape == NULL || schema == NULL || tape->count == 0)
+        return;
 
-            char *parent_fk_name = malloc(strlen(parent_table_name) + 4);
-            if (!parent_fk_name)
-            {
-                fprintf(stderr, "Error: Failed to allocate memory for parent FK name\n");
-                free(parent_table_name);
-                for (int i = 0; i < col_count; i++)
-                {
-                    free(values[i]);
-                }
-                free(values);
-                free(table_name);
-                return;
-            }
+    // Arrays are handled within the object case
+    if (tape_type(tape, 0) != TAPE_OBJECT_START)
+        return;
 
-            sprintf(parent_fk_name, "%s_id", parent_table_name);
+    fprintf(stderr, "Creating/finding table: root\n");
+    Table *table = find_table(schema, "root");
+    if (table == NULL)
+    {
+        table = create_table("root");
+        add_table(schema, table);
+        fprintf(stderr, "Created new table: root\n");
+    }
 
-            int parent_id_index = find_column_index(table, parent_fk_name);
-            if (parent_id_index >= 0 && parent_id_index < col_count)
-            {
-                char parent_id_str[32];
-                snprintf(parent_id_str, sizeof(parent_id_str), "%d", parent_id);
-                free(values[parent_id_index]);
-                values[parent_id_index] = strdup(parent_id_str);
-                if (!values[parent_id_index])
-                {
-                    fprintf(stderr, "Error: Failed to allocate memory for parent ID value\n");
-                    free(parent_fk_name);
-                    free(parent_table_name);
-                    for (int i = 0; i < col_count; i++)
-                    {
-                        free(values[i]);
-                    }
-                    free(values);
-                    free(table_name);
-                    return;
-                }
-                fprintf(stderr, "Set parent ID column %s to %s\n", parent_fk_name, parent_id_str);
-            }
+    TraversalStack *stack = &schema->stack;
+    stack_reset(stack, sizeof(Table *));
+    *(Table **)stack_push(stack) = table;
 
-            free(parent_fk_name);
-            free(parent_table_name);
+    size_t i = 1;
+    while (stack->count > 0)
+    {
+        if (tape_type(tape, i) == TAPE_OBJECT_END)
+        {
+            stack_pop(stack);
+            i++;
+            continue;
         }
 
-        // Process each pair in the object
-        Pair *pair = node->value.pairs;
-        while (pair != NULL)
+        table = *(Table **)stack_top(stack);
+        Atom key = tape_key(tape, i);
+        size_t value = i + 1;
+        TapeType type = tape_type(tape, value);
+
+        fprintf(stderr, "Processing key: %s\n", key);
+
+        if (type == TAPE_OBJECT_START)
         {
-            if (!pair->key)
+            // Nested object - create a new table with relationship
+            Atom child_table_name = table_name_of(key);
+            Table *child_table = find_table(schema, child_table_name);
+
+            if (child_table == NULL)
             {
-                fprintf(stderr, "Warning: NULL key in pair\n");
-                pair = pair->next;
-                continue;
+                // Add foreign key to parent table
+                child_table = create_child_table(schema, child_table_name, table);
             }
 
-            if (!pair->value)
+            // Create the nested table
+            *(Table **)stack_push(stack) = child_table;
+            i = value + 1;
+        }
+        else if (type == TAPE_ARRAY_START)
+        {
+            // Create a new table for this array
+            Atom array_table_name = table_name_of(key);
+            Table *array_table = find_table(schema, array_table_name);
+
+            if (array_table == NULL)
             {
-                fprintf(stderr, "Warning: NULL value for key '%s'\n", pair->key);
-                pair = pair->next;
-                continue;
+                // Add foreign key to parent table
+                array_table = create_child_table(schema, array_table_name, table);
             }
 
-            if (pair->value->type != NODE_OBJECT && pair->value->type != NODE_ARRAY)
-            {
-                // Regular value - set in current table
-                int col_index = find_column_index(table, pair->key);
+            // Process array elements to determine columns
+            if (pool_size() > 1 && tape_child_count(tape, value) >= 2 * SCHEMA_CHUNK_ELEMENTS)
+                infer_array_parallel(tape, value, array_table);
+            else
+                infer_array(tape, value, array_table);
 
-                if (col_index >= 0 && col_index < col_count)
-                {
-                    char *value_str = node_to_string(pair->value);
-                    if (!value_str)
-                    {
-                        fprintf(stderr, "Warning: Failed to convert value to string for column '%s'\n",
-                                pair->key);
-                        pair = pair->next;
-                        continue;
-                    }
-
-                    fprintf(stderr, "Setting value '%s' for column '%s' at index %d\n",
-                            value_str, pair->key, col_index);
-
-                    free(values[col_index]);
-                    values[col_index] = value_str;
-                }
-                else
-                {
-                    fprintf(stderr, "Column not found for key: %s\n", pair->key);
-                }
+            i = tape_end(tape, value) + 1;
+        }
+        else
+        {
+            // Regular scalar value - add as column
+            ColumnType column_type = column_type_of(tape, value);
+            const char *type_name = column_type_name(column_type);
+            if (type == TAPE_NUMBER)
+            {
+                fprintf(stderr, "Adding NUMBER column: %s as %s\n", key, type_name);
             }
-            else if (pair->value->type == NODE_OBJECT)
+            else if (type == TAPE_TRUE || type == TAPE_FALSE)
             {
-                // Nested object - recursively populate it
-                char *child_table_name = to_table_name(pair->key);
-                if (!child_table_name)
-                {
-                    fprintf(stderr, "Error: Failed to create child table name for '%s'\n", pair->key);
-                    pair = pair->next;
-                    continue;
-                }
-
-                int child_id = table->row_count + 1;
-                populate_data_from_node(pair->value, schema, pair->key, id, child_id);
-                free(child_table_name);
+                fprintf(stderr, "Adding BOOLEAN column: %s as %s\n", key, type_name);
             }
-            else if (pair->value->type == NODE_ARRAY)
+            else
             {
-                // Handle array values
-                char *array_table_name = to_table_name(pair->key);
-                if (!array_table_name)
-                {
-                    fprintf(stderr, "Error: Failed to create array table name for '%s'\n", pair->key);
-                    pair = pair->next;
-                    continue;
-                }
+                fprintf(stderr, "Adding TEXT column: %s as %s\n", key, type_name);
+            }
 
-                Table *array_table = find_table(schema, array_table_name);
-                if (array_table)
-                {
-                    fprintf(stderr, "Processing array '%s' in table '%s'\n", pair->key, table_name);
-
-                    // First, count the number of elements in the array
-                    Element *element = pair->value->value.elements;
-                    int element_count = 0;
-                    while (element != NULL)
-                    {
-                        element_count++;
-                        element = element->next;
-                    }
-                    fprintf(stderr, "Array '%s' has %d elements\n", pair->key, element_count);
-
-                    // Store elements in a separate array for correct ordering
-                    element = pair->value->value.elements;
-                    for (int elem_idx = 0; elem_idx < element_count && element != NULL; elem_idx++)
-                    {
-                        fprintf(stderr, "Processing array element %d of %d\n", elem_idx + 1, element_count);
-
-                        int array_col_count = get_column_count(array_table);
-                        fprintf(stderr, "Array table '%s' has %d columns\n", array_table_name, array_col_count);
-
-                        // Prepare row values for this array element
-                        char **array_values = malloc(array_col_count * sizeof(char *));
-                        if (!array_values)
-                        {
-                            fprintf(stderr, "Error: Failed to allocate memory for array values\n");
-                            element = element->next;
-                            continue;
-                        }
-
-                        // Initialize all values to empty strings
-                        for (int i = 0; i < array_col_count; i++)
-                        {
-                            array_values[i] = strdup("");
-                            if (!array_values[i])
-                            {
-                                fprintf(stderr, "Error: Failed to allocate memory for array value\n");
-                                // Clean up already allocated values
-                                for (int j = 0; j < i; j++)
-                                {
-                                    free(array_values[j]);
-                                }
-                                free(array_values);
-                                element = element->next;
-                                continue;
-                            }
-                        }
-
-                        // Set ID value for this array row
-                        int array_id = elem_idx + 1;
-                        char array_id_str[32];
-                        snprintf(array_id_str, sizeof(array_id_str), "%d", array_id);
-
-                        int array_id_index = find_column_index(array_table, "id");
-                        if (array_id_index >= 0 && array_id_index < array_col_count)
-                        {
-                            free(array_values[array_id_index]);
-                            array_values[array_id_index] = strdup(array_id_str);
-                            if (!array_values[array_id_index])
-                            {
-                                fprintf(stderr, "Error: Failed to allocate memory for array ID value\n");
-                                for (int i = 0; i < array_col_count; i++)
-                                {
-                                    free(array_values[i]);
-                                }
-                                free(array_values);
-                                element = element->next;
-                                continue;
-                            }
-                        }
-
-                        // Set foreign key to parent table
-                        char *parent_fk_name = malloc(strlen(table_name) + 4);
-                        if (!parent_fk_name)
-                        {
-                            fprintf(stderr, "Error: Failed to allocate memory for parent FK name\n");
-                            for (int i = 0; i < array_col_count; i++)
-                            {
-                                free(array_values[i]);
-                            }
-                            free(array_values);
-                            element = element->next;
-                            continue;
-                        }
-
-                        sprintf(parent_fk_name, "%s_id", table_name);
-                        int parent_fk_index = find_column_index(array_table, parent_fk_name);
-
-                        if (parent_fk_index >= 0 && parent_fk_index < array_col_count)
-                        {
-                            free(array_values[parent_fk_index]);
-                            array_values[parent_fk_index] = strdup(id_str);
-                            if (!array_values[parent_fk_index])
-                            {
-                                fprintf(stderr, "Error: Failed to allocate memory for parent FK value\n");
-                                free(parent_fk_name);
-                                for (int i = 0; i < array_col_count; i++)
-                                {
-                                    free(array_values[i]);
-                                }
-                                free(array_values);
-                                element = element->next;
-                                continue;
-                            }
-                        }
-                        free(parent_fk_name);
-
-                        if (element->value->type == NODE_OBJECT)
-                        {
-                            // For object elements, set column values
-                            Pair *obj_pair = element->value->value.pairs;
-                            while (obj_pair != NULL)
-                            {
-                                int obj_col_index = find_column_index(array_table, obj_pair->key);
-                                if (obj_col_index >= 0 && obj_col_index < array_col_count)
-                                {
-                                    char *value_str = node_to_string(obj_pair->value);
-                                    if (value_str)
-                                    {
-                                        fprintf(stderr, "Setting array value '%s' for column '%s' at index %d\n",
-                                                value_str, obj_pair->key, obj_col_index);
-                                        free(array_values[obj_col_index]);
-                                        array_values[obj_col_index] = value_str;
-                                    }
-                                }
-                                obj_pair = obj_pair->next;
-                            }
-                        }
-                        else
-                        {
-                            // For primitive elements, set the value column
-                            int value_col_index = find_column_index(array_table, "value");
-                            if (value_col_index >= 0 && value_col_index < array_col_count)
-                            {
-                                char *value_str = node_to_string(element->value);
-                                if (value_str)
-                                {
-                                    free(array_values[value_col_index]);
-                                    array_values[value_col_index] = value_str;
-                                }
-                            }
-                        }
-
-                        // Log the values we're about to add
-                        fprintf(stderr, "Adding array row with values: ");
-                        for (int i = 0; i < array_col_count; i++)
-                        {
-                            fprintf(stderr, "[%s] ", array_values[i] ? array_values[i] : "NULL");
-                        }
-                        fprintf(stderr, "\n");
-
-                        // Add the row
-                        add_row(array_table, array_values);
-
-                        // Move to next element
-                        element = element->next;
-                    }
-                }
-                else
-                {
-                    fprintf(stderr, "Warning: Array table '%s' not found\n", array_table_name);
-                }
+            fprintf(stderr, "About to add column '%s' to table '%s'\n", key, table->name);
+            add_column(table, key, column_type);
+            i = tape_next(tape, value);
+        }
+    }
+}
+
+// Same as find_column_index, for names that are already interned
+int find_column_slot(Table *table, Atom name)
+{
+    if (!table || !name)
+        return -1;
+
+    return column_index_find(&table->column_index, name);
+}
+
+// Helper function to find column index by name
+int find_column_index(Table *table, const char *column_name)
+{
+    if (!table || !column_name)
+        return -1;
+
+    Atom atom = intern_lookup(column_name);
+    if (atom == NULL)
+        return -1;
+
+    return column_index_find(&table->column_index, atom);
+}
+
+// Start a row for table with every column empty and the id and foreign key
+// set, logging to err unless it is NULL
+static Value *begin_row(Table *table, Table *parent, int parent_id, int id, FILE *err)
+{
+    const TablePlan *plan = &table->plan;
+
+    // Zeroed cells are VALUE_EMPTY
+    Value *values = xcalloc(plan->column_count ? plan->column_count : 1, sizeof(Value));
+
+    if (plan->id_slot >= 0)
+    {
+        values[plan->id_slot].kind = VALUE_INTEGER;
+        values[plan->id_slot].as.integer = id;
+        if (err)
+            fprintf(err, "Set ID column to %d\n", id);
+    }
+
+    // The foreign key is only meaningful when the row sits under the table it references
+    if (plan->fk_slot >= 0 && parent != NULL && parent == plan->parent && parent_id >= 0)
+    {
+        values[plan->fk_slot].kind = VALUE_INTEGER;
+        values[plan->fk_slot].as.integer = parent_id;
+        if (err)
+            fprintf(err, "Set parent ID column %s to %d\n", plan->fk_name, parent_id);
+    }
+
+    return values;
+}
+
+// Store the scalar at index of tape in value, converted to the final type
+// of its column: booleans in number columns become 1 or 0, and numbers in
+// text columns keep their text as written
+static void set_value(Value *value, ColumnType type, const Tape *tape, size_t index)
+{
+    clear_value(value);
+    switch (tape_type(tape, index))
+    {
+    case TAPE_STRING:
+        value->kind = VALUE_TEXT;
+        value->as.text = xstrdup(tape_string(tape, index));
+        break;
+    case TAPE_NUMBER:
+        if (type == TYPE_TEXT)
+        {
+            value->kind = VALUE_TEXT;
+            value->as.text = xstrdup(tape_number_text(tape, index));
+        }
+        else if (tape_integer(tape, index, &value->as.integer))
+        {
+            // Read from the text, so it keeps every digit
+            value->kind = VALUE_INTEGER;
+        }
+        else
+        {
+            value->kind = VALUE_REAL;
+            value->as.real = tape_number(tape, index);
+        }
+        break;
+    case TAPE_TRUE:
+    case TAPE_FALSE:
+        if (type == TYPE_INTEGER || type == TYPE_REAL)
+        {
+            value->kind = VALUE_INTEGER;
+            value->as.integer = tape_type(tape, index) == TAPE_TRUE;
+        }
+        else
+        {
+            value->kind = VALUE_BOOLEAN;
+            value->as.boolean = tape_type(tape, index) == TAPE_TRUE;
+        }
+        break;
+    case TAPE_NULL:
+        value->kind = VALUE_NULL;
+        break;
+    default:
+        value->kind = VALUE_COMPLEX;
+        break;
+    }
+}
 
-                free(array_table_name);
+// Build the row of array_table for the array element at index, logging to
+// err unless it is NULL
+static Value *populate_element(Tape *tape, size_t element, Schema *schema, Table *array_table, Table *table,
+                               int parent_id, int id, FILE *err)
+{
+    int array_col_count = array_table->plan.column_count;
+    char buffer[VALUE_BUFFER_SIZE];
+    Value *array_values = begin_row(array_table, table, parent_id, id, err);
+
+    if (tape_type(tape, element) == TAPE_OBJECT_START)
+    {
+        // For object elements, set column values
+        Shape *elem_shape = shape_for_object(schema, array_table, tape, element);
+        int obj_index = 0;
+        size_t obj_end = tape_end(tape, element);
+        for (size_t obj_key = element + 1; obj_key < obj_end; obj_key = tape_next(tape, obj_key + 1), obj_index++)
+        {
+            int obj_col_index = elem_shape->slots[obj_index];
+            if (obj_col_index >= 0 && obj_col_index < array_col_count)
+            {
+                set_value(&array_values[obj_col_index], array_table->column_slots[obj_col_index]->type, tape,
+                          obj_key + 1);
+                if (err)
+                    fprintf(err, "Setting array value '%s' for column '%s' at index %d\n",
+                            format_value(&array_values[obj_col_index], buffer), tape_key(tape, obj_key),
+                            obj_col_index);
             }
+        }
+    }
+    else
+    {
+        // For primitive elements, set the value column
+        int value_col_index = array_table->plan.value_slot;
+        if (value_col_index >= 0 && value_col_index < array_col_count)
+        {
+            set_value(&array_values[value_col_index], array_table->column_slots[value_col_index]->type, tape,
+                      element);
+        }
+    }
 
-            pair = pair->next;
+    // Log the values we're about to add
+    if (err)
+    {
+        fprintf(err, "Adding array row with values: ");
+        for (int i = 0; i < array_col_count; i++)
+        {
+            fprintf(err, "[%s] ", format_value(&array_values[i], buffer));
         }
+        fprintf(err, "\n");
+    }
+    return array_values;
+}
 
-        // Validate before adding row
-        fprintf(stderr, "Adding row with values: ");
-        for (int i = 0; i < col_count; i++)
+// Elements of a large array are populated in chunks on the thread pool.
+// A wave of chunks runs at a time and its rows are then appended in chunk
+// order, so the table reads as if one thread had done the work. Rows built
+// on the pool are not logged; each array gets one summary line.
+#define POPULATE_CHUNK_ELEMENTS 1024
+#define POPULATE_CHUNKS_PER_THREAD 4
+
+typedef struct ElementChunk
+{
+    size_t first;  // Tape index of the first element
+    int count;     // Elements
+    int first_id;  // Id of the first element's row
+    Row *rows;
+    Row *last_row;
+    int added;
+} ElementChunk;
+
+typedef struct ArrayPopulation
+{
+    Tape *tape;
+    Schema *schema;
+    Table *array_table;
+    Table *table;
+    int parent_id;
+    ElementChunk *chunks;
+} ArrayPopulation;
+
+static void populate_chunk(int index, void *arg)
+{
+    ArrayPopulation *array = arg;
+    ElementChunk *chunk = &array->chunks[index];
+    size_t element = chunk->first;
+    for (int k = 0; k < chunk->count; k++, element = tape_next(array->tape, element))
+    {
+        Value *values = populate_element(array->tape, element, array->schema, array->array_table, array->table,
+                                         array->parent_id, chunk->first_id + k, NULL);
+        Row *row = xmalloc(sizeof(Row));
+        row->values = values;
+        row->next = NULL;
+        if (chunk->rows == NULL)
+            chunk->rows = row;
+        else
+            chunk->last_row->next = row;
+        chunk->last_row = row;
+        chunk->added++;
+    }
+}
+
+static void populate_array_parallel(Tape *tape, size_t index, Schema *schema, Table *array_table, Table *table,
+                                    int parent_id, int first_id)
+{
+    int wave = pool_size() * POPULATE_CHUNKS_PER_THREAD;
+    ElementChunk *chunks = xmalloc(wave * sizeof(ElementChunk));
+    ArrayPopulation array = {tape, schema, array_table, table, parent_id, chunks};
+
+    size_t element = index + 1;
+    size_t end = tape_end(tape, index);
+    int id = first_id;
+    int added = 0;
+    while (element < end)
+    {
+        // Running sums of the chunk sizes give every chunk its ids
+        int count = 0;
+        for (; count < wave && element < end; count++)
         {
-            fprintf(stderr, "[%s] ", values[i] ? values[i] : "NULL");
+            ElementChunk *chunk = &chunks[count];
+            memset(chunk, 0, sizeof(ElementChunk));
+            chunk->first = element;
+            chunk->first_id = id;
+            while (element < end && chunk->count < POPULATE_CHUNK_ELEMENTS)
+            {
+                element = tape_next(tape, element);
+                chunk->count++;
+            }
+            id += chunk->count;
         }
-        fprintf(stderr, "\n");
 
-        // Add row to table
-        add_row(table, values);
+        parallel_for(count, populate_chunk, &array);
+        for (int c = 0; c < count; c++)
+        {
+            ElementChunk *chunk = &chunks[c];
+            if (chunk->rows != NULL)
+            {
+                if (array_table->rows == NULL)
+                    array_table->rows = chunk->rows;
+                else
+                    array_table->last_row->next = chunk->rows;
+                array_table->last_row = chunk->last_row;
+                array_table->row_count += chunk->added;
+                added += chunk->added;
+            }
+        }
+    }
+    xfree(chunks);
+    fprintf(stderr, "Added %d rows to table '%s' on %d threads, now has %d rows\n", added, array_table->name,
+            pool_size(), array_table->row_count);
+}
 
-        free(table_name);
-        break;
+// Add one row to array_table for every element of the array at index. The
+// array takes one contiguous range of ids, in element order.
+static void populate_array(Tape *tape, size_t index, Schema *schema, Table *array_table, Table *table, int id)
+{
+    int count = tape_child_count(tape, index);
+    int first_id = allocate_ids(array_table, count);
+    if (pool_size() > 1 && count >= 2 * POPULATE_CHUNK_ELEMENTS)
+    {
+        populate_array_parallel(tape, index, schema, array_table, table, id, first_id);
+        return;
     }
 
-    default:
-        fprintf(stderr, "Ignoring node of type %d\n", node->type);
-        break;
+    int elem_idx = 0;
+    size_t end = tape_end(tape, index);
+    for (size_t element = index + 1; element < end; element = tape_next(tape, element), elem_idx++)
+    {
+        Value *array_values = populate_element(tape, element, schema, array_table, table, id, first_id + elem_idx,
+                                               stderr);
+        add_row(array_table, array_values);
+    }
+}
+
+// One object being walked by populate_data_from_tape. Its row stays open
+// until the object ends, so nested rows are added first.
+typedef struct PopulateFrame
+{
+    Table *table;
+    Value *values;
+    Shape *shape;
+    int key_index; // Position of the next key within the shape
+    int id;
+} PopulateFrame;
+
+// Open a row for the object at index; returns 0 if it has to be skipped
+static int push_object(TraversalStack *stack, Tape *tape, size_t index, Schema *schema, Table *table,
+                       Table *parent, int parent_id)
+{
+    if (!table)
+    {
+        fprintf(stderr, "Error: No table for object\n");
+        return 0;
     }
+
+    // Ids follow the order objects open in, which does not depend on how
+    // the rows are produced
+    int id = allocate_ids(table, 1);
+    Value *values = begin_row(table, parent, parent_id, id, stderr);
+
+    PopulateFrame *frame = stack_push(stack);
+    frame->table = table;
+    frame->values = values;
+    // Resolve the column slot of every key with a single cache probe
+    frame->shape = shape_for_object(schema, table, tape, index);
+    frame->key_index = 0;
+    frame->id = id;
+    return 1;
 }
-void write_schema_to_csv(Schema *schema, const char *out_dir)
+
+void populate_data_from_tape(Tape *tape, Schema *schema)
 {
-    if (schema == NULL || out_dir == NULL)
+    if (tape == NULL || schema == NULL || tape->count == 0)
     {
-        fprintf(stderr, "Error: NULL schema or output directory\n");
+        fprintf(stderr, "Warning: NULL tape or schema in populate_data_from_tape\n");
         return;
     }
 
-    Table *table = schema->tables;
-    while (table != NULL)
+    if (tape_type(tape, 0) != TAPE_OBJECT_START)
     {
-        if (!table->name)
-        {
-            fprintf(stderr, "Error: Table with NULL name encountered\n");
-            table = table->next;
-            continue;
-        }
+        fprintf(stderr, "Ignoring node of type %c\n", tape_type(tape, 0));
+        return;
+    }
 
-        char filename[256];
-        snprintf(filename, sizeof(filename), "%s/%s.csv", out_dir, table->name);
+    TraversalStack *stack = &schema->stack;
+    stack_reset(stack, sizeof(PopulateFrame));
+    if (!push_object(stack, tape, 0, schema, find_table(schema, "root"), NULL, -1))
+        return;
+
+    size_t i = 1;
+    PopulateFrame *frame;
+    while ((frame = stack_top(stack)) != NULL)
+    {
+        Table *table = frame->table;
+        Value *values = frame->values;
+        int col_count = table->plan.column_count;
 
-        FILE *file = fopen(filename, "w");
-        if (file == NULL)
+        if (tape_type(tape, i) == TAPE_OBJECT_END)
         {
-            fprintf(stderr, "Error: Could not open file %s for writing\n", filename);
-            table = table->next;
+            // Validate before adding row
+            char buffer[VALUE_BUFFER_SIZE];
+            fprintf(stderr, "Adding row with values: ");
+            for (int c = 0; c < col_count; c++)
+            {
+                fprintf(stderr, "[%s] ", format_value(&values[c], buffer));
+            }
+            fprintf(stderr, "\n");
+
+            // Add row to table
+            add_row(table, values);
+            stack_pop(stack);
+            i++;
             continue;
         }
 
-        int col_count = get_column_count(table);
-        fprintf(stderr, "Writing table '%s' with %d columns to CSV\n", table->name, col_count);
+        Atom key = tape_key(tape, i);
+        size_t value = i + 1;
+        TapeType type = tape_type(tape, value);
+        int key_index = frame->key_index++;
+        Shape *shape = frame->shape;
+        int id = frame->id;
 
-        // Write header
-        Column *column = table->columns;
-        fprintf(stderr, "Writing headers: ");
-        while (column != NULL)
+        if (type != TAPE_OBJECT_START && type != TAPE_ARRAY_START)
         {
-            if (column->name)
+            // Regular value - set in current table
+            int col_index = shape->slots[key_index];
+
+            if (col_index >= 0 && col_index < col_count)
             {
-                fprintf(file, "%s", column->name);
-                fprintf(stderr, "%s ", column->name);
+                char buffer[VALUE_BUFFER_SIZE];
+                set_value(&values[col_index], table->column_slots[col_index]->type, tape, value);
+                fprintf(stderr, "Setting value '%s' for column '%s' at index %d\n",
+                        format_value(&values[col_index], buffer), key, col_index);
             }
             else
             {
-                fprintf(file, "unnamed_column");
-                fprintf(stderr, "unnamed_column ");
+                fprintf(stderr, "Column not found for key: %s\n", key);
             }
-
-            if (column->next != NULL)
+            i = tape_next(tape, value);
+        }
+        else if (type == TAPE_OBJECT_START)
+        {
+            // Nested object - populate it before the rest of this object
+            if (push_object(stack, tape, value, schema, shape->children[key_index], table, id))
+                i = value + 1;
+            else
+                i = tape_next(tape, value);
+        }
+        else
+        {
+            // Handle array values
+            Table *array_table = shape->children[key_index];
+            if (array_table)
             {
-                fprintf(file, ",");
+                fprintf(stderr, "Processing array '%s' in table '%s'\n", key, table->name);
+                populate_array(tape, value, schema, array_table, table, id);
             }
-            column = column->next;
+            else
+            {
+                fprintf(stderr, "Warning: Array table for '%s' not found\n", key);
+            }
+            i = tape_next(tape, value);
         }
-        fprintf(stderr, "\n");
-        fprintf(file, "\n");
+    }
+}
+// Write the header line of a table, logging to err unless it is NULL
+static void write_table_header(Table *table, FILE *file, FILE *err)
+{
+    int col_count = table->column_count;
+    if (err)
+    {
+        fprintf(err, "Table '%s' has %d columns\n", table->name, col_count);
+        fprintf(err, "Writing table '%s' with %d columns to CSV\n", table->name, col_count);
+        fprintf(err, "Writing headers: ");
+    }
 
-        // Write data rows
-        fprintf(stderr, "Table '%s' has %d rows\n", table->name, table->row_count);
-        Row *row = table->rows;
-        int row_count = 0;
+    // Write header
+    Column *column = table->columns;
+    while (column != NULL)
+    {
+        if (column->name)
+        {
+            fprintf(file, "%s", column->name);
+            if (err)
+                fprintf(err, "%s ", column->name);
+        }
+        else
+        {
+            fprintf(file, "unnamed_column");
+            if (err)
+                fprintf(err, "unnamed_column ");
+        }
 
-        while (row != NULL)
+        if (column->next != NULL)
         {
-            row_count++;
-            fprintf(stderr, "Writing row %d/%d: ", row_count, table->row_count);
+            fprintf(file, ",");
+        }
+        column = column->next;
+    }
+    fprintf(file, "\n");
+    if (err)
+    {
+        fprintf(err, "\n");
+        fprintf(err, "Table '%s' has %d rows\n", table->name, table->row_count);
+    }
+}
 
-            // Check if row values are valid
-            if (!row->values)
-            {
-                fprintf(stderr, "Warning: NULL row values for row %d\n", row_count);
-                fprintf(file, "\n");
-                row = row->next;
-                continue;
-            }
+// Write up to count rows starting at first, which is row number + 1 of the
+// table, logging to err unless it is NULL
+static void write_table_rows(Table *table, Row *first, int count, int number, FILE *file, FILE *err)
+{
+    int col_count = table->column_count;
+    char buffer[VALUE_BUFFER_SIZE];
+    Column *column;
+    Row *row = first;
+    int row_count = number;
+
+    while (row != NULL && row_count - number < count)
+    {
+        row_count++;
+        if (err)
+            fprintf(err, "Writing row %d/%d: ", row_count, table->row_count);
+
+        // Check if row values are valid
+        if (!row->values)
+        {
+            fprintf(err ? err : stderr, "Warning: NULL row values for row %d\n", row_count);
+            fprintf(file, "\n");
+            row = row->next;
+            continue;
+        }
 
-            column = table->columns;
-            int col_index = 0;
-            while (column != NULL)
+        column = table->columns;
+        int col_index = 0;
+        while (column != NULL)
+        {
+            if (col_index < col_count)
             {
-                if (col_index < col_count && row->values[col_index])
+                // CSV escaping: if value contains comma, quote it. Only text
+                // can contain one.
+                const Value *cell = &row->values[col_index];
+                const char *value = format_value(cell, buffer);
+                if (cell->kind == VALUE_TEXT && strpbrk(value, ",\"\n"))
                 {
-                    // CSV escaping: if value contains comma, quote it
-                    char *value = row->values[col_index];
-                    if (strchr(value, ',') || strchr(value, '"') || strchr(value, '\n'))
-                    {
-                        fprintf(file, "\"%s\"", value);
-                    }
-                    else
-                    {
-                        fprintf(file, "%s", value);
-                    }
-
-                    fprintf(stderr, "[%s=%s] ",
-                            column->name ? column->name : "unnamed",
-                            row->values[col_index]);
+                    fprintf(file, "\"%s\"", value);
                 }
                 else
                 {
-                    fprintf(file, "");
-                    fprintf(stderr, "[%s=EMPTY] ", column->name ? column->name : "unnamed");
+                    fputs(value, file);
                 }
 
-                if (column->next != NULL)
+                if (err)
                 {
-                    fprintf(file, ",");
+                    fprintf(err, "[%s=%s] ",
+                            column->name ? column->name : "unnamed",
+                            value);
                 }
-                column = column->next;
-                col_index++;
+            }
+            else if (err)
+            {
+                // The field is left empty
+                fprintf(err, "[%s=EMPTY] ", column->name ? column->name : "unnamed");
             }
 
-            fprintf(stderr, "\n");
-            fprintf(file, "\n");
+            if (column->next != NULL)
+            {
+                fprintf(file, ",");
+            }
+            column = column->next;
+            col_index++;
+        }
+
+        if (err)
+            fprintf(err, "\n");
+        fprintf(file, "\n");
+
+        // Save previous row in case next causes problems
+        Row *prev_row = row;
+        row = row->next;
+
+        // Safety check
+        if (row == prev_row)
+        {
+            fprintf(err ? err : stderr, "Error: Circular reference detected in row list\n");
+            break;
+        }
+    }
+}
+
+// Write the header and rows of one table as CSV
+static void write_table(Table *table, FILE *file, FILE *err)
+{
+    write_table_header(table, file, err);
+    write_table_rows(table, table->rows, INT_MAX, 0, file, err);
+}
+
+void write_table_to_csv(Table *table, FILE *file)
+{
+    write_table(table, file, stderr);
+}
+
+// Write one table to sink through a stdio stream buffered in buffer,
+// adding the bytes written to *bytes and logging to err unless it is NULL
+static int write_table_to_sink(Table *table, Sink *sink, char *buffer, size_t size, long long *bytes,
+                               FILE *err)
+{
+    if (!table->name)
+    {
+        fprintf(stderr, "Error: Table with NULL name encountered\n");
+        return 0;
+    }
+
+    if (sink->begin_table(sink, table->name) != 0)
+        return -1;
+
+    SinkStream stream;
+    FILE *file = open_sink_stream(&stream, sink, bytes);
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Could not open the output stream for table %s\n", table->name);
+        sink->end_table(sink);
+        return -1;
+    }
+    setvbuf(file, buffer, _IOFBF, size);
+
+    write_table(table, file, err);
 
-            // Save previous row in case next causes problems
-            Row *prev_row = row;
+    int failed = fclose(file) != 0;
+    if (sink->end_table(sink) != 0 || failed)
+        return -1;
+    return 0;
+}
+
+// Write every table to sink. Returns -1 if any table could not be
+// written, 0 otherwise.
+int write_schema_to_sink(Schema *schema, Sink *sink)
+{
+    if (schema == NULL || sink == NULL)
+    {
+        fprintf(stderr, "Error: NULL schema or output sink\n");
+        return -1;
+    }
+
+    int status = 0;
+    char buffer[65536];
+    stats_begin(PHASE_WRITE);
+    for (Table *table = schema->tables; table != NULL; table = table->next)
+    {
+        if (write_table_to_sink(table, sink, buffer, sizeof(buffer), &run_stats.bytes_written, stderr) != 0)
+        {
+            status = -1;
+        }
+    }
+    stats_end(PHASE_WRITE);
+    return status;
+}
+
+// Write every table to <out_dir>/<table>.csv
+int write_schema_to_csv(Schema *schema, const char *out_dir)
+{
+    if (schema == NULL || out_dir == NULL)
+    {
+        fprintf(stderr, "Error: NULL schema or output directory\n");
+        return -1;
+    }
+
+    Sink *sink = create_dir_sink(NULL, out_dir);
+    if (sink == NULL)
+        fatal_error("Memory allocation failed");
+    int status = write_schema_to_sink(schema, sink);
+    free_sink(sink);
+    return status;
+}
+
+static void write_json_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(file, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(file, "\\u%04x", *p);
+        else
+            fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+// Write SCHEMA_SIDECAR to out_dir: every table with its file, its row count
+// and the final type of each column, so a loader need not guess the types
+// from the CSV text
+int write_schema_sidecar(Schema *schema, const char *out_dir)
+{
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/%s", out_dir, SCHEMA_SIDECAR) >= (int)sizeof(path))
+    {
+        fprintf(stderr, "Error: Path too long for %s\n", SCHEMA_SIDECAR);
+        return -1;
+    }
+
+    // Replace rather than truncate, like the CSV files
+    unlink(path);
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Could not open file %s for writing\n", path);
+        return -1;
+    }
+
+    fprintf(file, "{\n  \"tables\": [");
+    int first = 1;
+    for (Table *table = schema->tables; table != NULL; table = table->next)
+    {
+        if (!table->name)
+            continue;
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"file\": \"%s.csv\", \"rows\": %d, \"columns\": [", first ? "" : ",",
+                table->name, table->name, table->row_count);
+        for (Column *column = table->columns; column != NULL; column = column->next)
+        {
+            fprintf(file, "%s\n      {\"name\": ", column == table->columns ? "" : ",");
+            write_json_string(file, column->name);
+            fprintf(file, ", \"type\": \"%s\"}", column_type_name(column->type));
+        }
+        fprintf(file, "\n    ]}");
+        first = 0;
+    }
+    fprintf(file, "%s]\n}\n", first ? "" : "\n  ");
+
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "Error: Could not write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct TableJob
+{
+    Table *table;
+    int order; // Position in the schema
+    Sink *sink;
+    long long bytes;
+    int status;
+} TableJob;
+
+// Rows times columns approximates the bytes a table formats
+static long long table_weight(const Table *table)
+{
+    return (long long)table->row_count * (table->column_count + 1);
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    const TableJob *x = a;
+    const TableJob *y = b;
+    long long wx = table_weight(x->table);
+    long long wy = table_weight(y->table);
+    if (wx != wy)
+        return wx > wy ? -1 : 1;
+    return x->order - y->order;
+}
+
+static int compare_job_order(const void *a, const void *b)
+{
+    return ((const TableJob *)a)->order - ((const TableJob *)b)->order;
+}
+
+// A table too large for one thread is split into chunks of rows. Their
+// exact CSV lengths are measured in parallel, a prefix sum places each
+// chunk in the file, and the chunks are formatted in parallel straight to
+// their offsets with pwrite.
+#define SPLIT_MIN_CHUNK_ROWS 1024
+#define SPLIT_CHUNKS_PER_THREAD 8
+
+typedef struct RowChunk
+{
+    Row *first;
+    int count;
+    int number; // Rows of the table before the chunk
+    off_t offset;
+    size_t len;
+    int status;
+} RowChunk;
+
+typedef struct SplitTable
+{
+    Table *table;
+    RowChunk *chunks;
+    int fd;
+} SplitTable;
+
+// Bytes write_table_rows writes for row
+static size_t row_csv_length(const Table *table, const Row *row)
+{
+    if (!row->values)
+        return 1;
+
+    size_t len = 0;
+    int col_index = 0;
+    char buffer[VALUE_BUFFER_SIZE];
+    for (const Column *column = table->columns; column != NULL; column = column->next, col_index++)
+    {
+        if (col_index < table->column_count)
+        {
+            const Value *cell = &row->values[col_index];
+            const char *value = format_value(cell, buffer);
+            len += strlen(value);
+            if (cell->kind == VALUE_TEXT && strpbrk(value, ",\"\n"))
+                len += 2;
+        }
+        if (column->next != NULL)
+            len++;
+    }
+    return len + 1;
+}
+
+static void measure_chunk(int index, void *arg)
+{
+    SplitTable *split = arg;
+    RowChunk *chunk = &split->chunks[index];
+    Row *row = chunk->first;
+    size_t len = 0;
+    for (int i = 0; i < chunk->count; i++, row = row->next)
+    {
+        len += row_csv_length(split->table, row);
+    }
+    chunk->len = len;
+}
+
+static void format_chunk(int index, void *arg)
+{
+    SplitTable *split = arg;
+    RowChunk *chunk = &split->chunks[index];
+    char buffer[65536];
+    OffsetStream stream;
+    FILE *file = open_offset_stream(&stream, split->fd, chunk->offset);
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Could not open the output stream for table %s\n", split->table->name);
+        chunk->status = -1;
+        return;
+    }
+    setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+    write_table_rows(split->table, chunk->first, chunk->count, chunk->number, file, NULL);
+    int failed = fclose(file) != 0;
+
+    // The measured length placed the next chunk, so any other length
+    // would corrupt the file
+    if (failed || stream.offset != chunk->offset + (off_t)chunk->len)
+    {
+        fprintf(stderr, "Error: Could not write table %s\n", split->table->name);
+        chunk->status = -1;
+    }
+}
+
+static int write_table_split(Table *table, Sink *sink, long long *bytes)
+{
+    if (sink->begin_table(sink, table->name) != 0)
+        return -1;
+
+    int rows_per_chunk = table->row_count / (pool_size() * SPLIT_CHUNKS_PER_THREAD);
+    if (rows_per_chunk < SPLIT_MIN_CHUNK_ROWS)
+        rows_per_chunk = SPLIT_MIN_CHUNK_ROWS;
+    int capacity = table->row_count / rows_per_chunk + 1;
+    SplitTable split = {table, xcalloc(capacity, sizeof(RowChunk)), dir_sink_fd(sink)};
+
+    // One walk of the row list finds where each chunk starts
+    int count = 0;
+    int number = 0;
+    Row *row = table->rows;
+    while (row != NULL && count < capacity)
+    {
+        RowChunk *chunk = &split.chunks[count++];
+        chunk->first = row;
+        chunk->number = number;
+        while (row != NULL && chunk->count < rows_per_chunk)
+        {
+            chunk->count++;
             row = row->next;
+        }
+        number += chunk->count;
+    }
 
-            // Safety check
-            if (row == prev_row)
-            {
-                fprintf(stderr, "Error: Circular reference detected in row list\n");
-                break;
-            }
+    int status = 0;
+    char buffer[4096];
+    OffsetStream stream;
+    FILE *file = open_offset_stream(&stream, split.fd, 0);
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Could not open the output stream for table %s\n", table->name);
+        status = -1;
+    }
+    else
+    {
+        setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+        write_table_header(table, file, NULL);
+        if (fclose(file) != 0)
+            status = -1;
+    }
+
+    if (status == 0)
+    {
+        parallel_for(count, measure_chunk, &split);
+        off_t offset = stream.offset;
+        for (int i = 0; i < count; i++)
+        {
+            split.chunks[i].offset = offset;
+            offset += split.chunks[i].len;
+        }
+        // Reserve the whole file up front; where that is not supported the
+        // writes extend it instead
+        posix_fallocate(split.fd, 0, offset);
+
+        parallel_for(count, format_chunk, &split);
+        for (int i = 0; i < count; i++)
+        {
+            if (split.chunks[i].status != 0)
+                status = -1;
         }
+        *bytes += offset;
+    }
 
-        fclose(file);
-        table = table->next;
+    if (sink->end_table(sink) != 0)
+        status = -1;
+    xfree(split.chunks);
+    return status;
+}
+
+// A table is split when it alone would take longer than an even share of
+// the work
+static int should_split(const Table *table, long long total_weight, int threads)
+{
+    return table->name && table->row_count >= 2 * SPLIT_MIN_CHUNK_ROWS &&
+           table_weight(table) * threads > total_weight;
+}
+
+static void write_table_job(int index, void *arg)
+{
+    TableJob *job = &((TableJob *)arg)[index];
+    char buffer[65536];
+    job->status = write_table_to_sink(job->table, job->sink, buffer, sizeof(buffer), &job->bytes, NULL);
+}
+
+// write_schema_to_csv on the thread pool. Tables that dominate the work
+// are split across all threads one after another; the rest are
+// written one table per task with the largest first. The files are the
+// same as the serial writer's. Rows are not logged; each table gets one
+// summary line, in table order once all are written.
+int write_schema_to_csv_parallel(Schema *schema, const char *out_dir)
+{
+    int threads = pool_size();
+    if (threads <= 1 || schema == NULL)
+        return write_schema_to_csv(schema, out_dir);
+
+    TableJob *jobs = xcalloc(schema->table_count, sizeof(TableJob));
+    int count = 0;
+    for (Table *table = schema->tables; table != NULL && count < schema->table_count; table = table->next)
+    {
+        jobs[count].table = table;
+        jobs[count].order = count;
+        jobs[count].sink = create_dir_sink(NULL, out_dir);
+        if (jobs[count].sink == NULL)
+            fatal_error("Memory allocation failed");
+        count++;
+    }
+    qsort(jobs, count, sizeof(TableJob), compare_jobs);
+
+    long long total_weight = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total_weight += table_weight(jobs[i].table);
+    }
+    int split = 0;
+    while (split < count && should_split(jobs[split].table, total_weight, threads))
+    {
+        split++;
+    }
+
+    stats_begin(PHASE_WRITE);
+    for (int i = 0; i < split; i++)
+    {
+        jobs[i].status = write_table_split(jobs[i].table, jobs[i].sink, &jobs[i].bytes);
+    }
+    parallel_for(count - split, write_table_job, jobs + split);
+    stats_end(PHASE_WRITE);
+
+    // Back in table order for the log
+    qsort(jobs, count, sizeof(TableJob), compare_job_order);
+    int status = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Table *table = jobs[i].table;
+        fprintf(stderr, "Wrote table '%s' with %d columns and %d rows\n", table->name, table->column_count,
+                table->row_count);
+        run_stats.bytes_written += jobs[i].bytes;
+        if (jobs[i].status != 0)
+            status = -1;
+        free_sink(jobs[i].sink);
     }
+    xfree(jobs);
+    return status;
 }
@@ -1,39 +1,119 @@
 #ifndef SCHEMA_H
 #define SCHEMA_H
 
+#include <stdio.h>
 #include "ast.h"
+#include "intern.h"
+#include "shape.h"
+#include "tape.h"
+#include "sink.h"
 
 typedef struct Column Column;
 typedef struct Table Table;
 typedef struct Schema Schema;
 typedef struct Row Row;
 
+// Column types form a lattice in which each type widens to the ones after
+// it; a column has the join of the types of all its values
+typedef enum
+{
+    TYPE_NULL,    // Only nulls, or no values at all
+    TYPE_BOOLEAN,
+    TYPE_INTEGER, // Numbers without a fraction or exponent that fit in a long long
+    TYPE_REAL,    // Other numbers, except integers too long for a long long
+    TYPE_TEXT     // Strings, nested values and integers too long for a long long
+} ColumnType;
+
+// The file next to the CSV files that lists every table's columns and types
+#define SCHEMA_SIDECAR "schema.json"
+
+// A cell keeps its value in its own type; text is only made when writing
+typedef enum
+{
+    VALUE_EMPTY, // The object had no such key
+    VALUE_NULL,
+    VALUE_BOOLEAN,
+    VALUE_INTEGER,
+    VALUE_REAL,
+    VALUE_TEXT,
+    VALUE_COMPLEX // A nested object or array
+} ValueKind;
+
+typedef struct Value
+{
+    ValueKind kind;
+    union
+    {
+        int boolean;
+        long long integer;
+        double real;
+        char *text;
+    } as;
+} Value;
+
+// Big enough for format_value to format any number
+#define VALUE_BUFFER_SIZE 32
+
 struct Column
 {
-    char *name;
-    char *type;
+    Atom name;
+    ColumnType type;
     Column *next;
 };
 
 struct Row
 {
-    char **values; // Array of strings (each corresponding to a column's value)
+    Value *values; // One cell per column
     Row *next;
 };
 
+// Everything the per-row path needs to know about a table, resolved once
+// so populating a row does no name lookups
+typedef struct TablePlan
+{
+    Table *parent;    // Table referenced by the foreign key, NULL for root
+    Atom fk_name;     // <parent>_id
+    int column_count;
+    int id_slot;
+    int fk_slot;      // -1 if the table has no parent
+    int value_slot;   // Column of an array of scalars, -1 if none
+} TablePlan;
+
+// Open-addressing map from column name to slot, so finding a column does
+// not walk the column list
+typedef struct ColumnIndex
+{
+    Atom *names;
+    int *slots;
+    int capacity;
+} ColumnIndex;
+
 struct Table
 {
-    char *name;
+    Atom name;
     Column *columns;
+    Column *last_column;
+    int column_count;
+    ColumnIndex column_index;
+    Column **column_slots; // Columns by slot, column_slot_capacity of them
+    int column_slot_capacity;
     Row *rows; // A list of rows in this table
+    Row *last_row;
     Table *next;
     int row_count;
+    int next_id; // Last id handed out by allocate_ids
+    TablePlan plan;
 };
 
 struct Schema
 {
     Table *tables;
+    Table *last_table;
     int table_count;
+    Table **tables_by_name; // Indexed by the atom id of the table name
+    int tables_by_name_capacity;
+    ShapeCache *shapes; // Key sequence -> column slots, used while populating
+    TraversalStack stack; // Reused by the schema and population walks
 };
 
 // Schema operations
@@ -44,22 +124,39 @@ Table *find_table(Schema *schema, const char *name);
 
 // Table operations
 Table *create_table(const char *name);
+Table *create_child_table(Schema *schema, const char *name, Table *parent);
+void build_table_plans(Schema *schema);
 void free_table(Table *table);
-void add_column(Table *table, const char *name, const char *type);
-void add_row(Table *table, char **values);
+void add_column(Table *table, const char *name, ColumnType type);
+void add_row(Table *table, Value *values);
+int allocate_ids(Table *table, int count);
 Column *find_column(Table *table, const char *name);
 int get_column_count(Table *table);
 void debug_print_table(Table *table);
 int find_column_index(Table *table, const char *column_name);
+int find_column_slot(Table *table, Atom name);
 
 // String helpers
-char *to_table_name(const char *str);
+Atom to_table_name(const char *str);
+Atom table_name_of(Atom key);
+void free_table_name_cache(void);
 char *node_to_string(Node *node);
 
+// Values
+ColumnType widen_type(ColumnType a, ColumnType b);
+const char *column_type_name(ColumnType type);
+const char *format_value(const Value *value, char *buffer);
+
 // Schema generation
 void process_ast(Node *root, const char *out_dir);
-void generate_schema_from_node(Node *node, Schema *schema, const char *parent_table);
-void populate_data_from_node(Node *node, Schema *schema, const char *parent_table, int parent_id, int id);
-void write_schema_to_csv(Schema *schema, const char *out_dir);
+void process_tape(Tape *tape, const char *out_dir);
+Schema *convert_tape(Tape *tape);
+void generate_schema_from_tape(Tape *tape, Schema *schema);
+void populate_data_from_tape(Tape *tape, Schema *schema);
+int write_schema_to_sink(Schema *schema, Sink *sink);
+int write_schema_to_csv(Schema *schema, const char *out_dir);
+int write_schema_to_csv_parallel(Schema *schema, const char *out_dir);
+int write_schema_sidecar(Schema *schema, const char *out_dir);
+void write_table_to_csv(Table *table, FILE *file);
 
 #endif // SCHEMA_H
\ No newline at end of file
@@ -0,0 +1,681 @@
+// json2relcsv --serve: a pool of workers accepting conversions on a Unix
+// domain socket. Each worker keeps its context, arena, output buffer and
+// input buffer from one request to the next, so a warm worker converts
+// without going back to malloc for anything but growth.
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "server.h"
+#include "json2relcsv.h"
+#include "parser.h"
+#include "sink.h"
+
+#define ARENA_CHUNK_SIZE (1 << 20)
+#define ARENA_RETAIN ((size_t)64 << 20) // Memory a worker keeps between requests
+#define REQUEST_LINE_MAX 8192
+#define REQUEST_TIMEOUT 30              // Seconds a client may stall
+
+// Arena allocator. Blocks are carved from a list of chunks and only given
+// back all at once by arena_reset, apart from the most recent block, which
+// can grow or be freed in place (the common pattern of a growing array).
+typedef union ArenaBlock
+{
+    size_t size;
+    max_align_t align;
+} ArenaBlock;
+
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t capacity;
+    size_t used;
+    ArenaBlock data[];
+} ArenaChunk;
+
+typedef struct Arena
+{
+    ArenaChunk *first;
+    ArenaChunk *current; // Chunks after it are empty
+    ArenaChunk *mark;    // Where arena_reset goes back to
+    size_t mark_used;
+    ArenaBlock *last;
+} Arena;
+
+typedef struct Worker
+{
+    pthread_t thread;
+    int listen_fd;
+    int stop_fd;
+    Arena arena;
+    J2RContext *ctx;
+    J2RSink *sink;
+    char *input;
+    size_t input_capacity;
+    size_t max_request;
+    long requests;
+} Worker;
+
+static size_t arena_round(size_t size)
+{
+    return (size + sizeof(ArenaBlock) - 1) / sizeof(ArenaBlock) * sizeof(ArenaBlock);
+}
+
+static ArenaChunk *new_chunk(size_t capacity)
+{
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + capacity);
+    if (chunk == NULL)
+        return NULL;
+    chunk->next = NULL;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    return chunk;
+}
+
+static void *arena_malloc(size_t size, void *user)
+{
+    Arena *arena = user;
+    if (size > SIZE_MAX / 2)
+        return NULL;
+    size_t need = sizeof(ArenaBlock) + arena_round(size);
+
+    ArenaChunk *chunk = arena->current;
+    while (chunk && chunk->capacity - chunk->used < need)
+    {
+        chunk = chunk->next;
+    }
+    if (chunk == NULL)
+    {
+        chunk = new_chunk(need > ARENA_CHUNK_SIZE ? need : ARENA_CHUNK_SIZE);
+        if (chunk == NULL)
+            return NULL;
+        chunk->next = arena->current->next;
+        arena->current->next = chunk;
+    }
+
+    ArenaBlock *block = (ArenaBlock *)((char *)chunk->data + chunk->used);
+    block->size = size;
+    chunk->used += need;
+    arena->current = chunk;
+    arena->last = block;
+    return block + 1;
+}
+
+static void *arena_realloc(void *ptr, size_t size, void *user)
+{
+    Arena *arena = user;
+    if (ptr == NULL)
+        return arena_malloc(size, user);
+
+    ArenaBlock *block = (ArenaBlock *)ptr - 1;
+    if (block == arena->last && size <= SIZE_MAX / 2)
+    {
+        ArenaChunk *chunk = arena->current;
+        size_t available = chunk->capacity - chunk->used + arena_round(block->size);
+        if (arena_round(size) <= available)
+        {
+            chunk->used = chunk->used - arena_round(block->size) + arena_round(size);
+            block->size = size;
+            return ptr;
+        }
+    }
+
+    size_t old_size = block->size;
+    void *copy = arena_malloc(size, user);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, ptr, old_size < size ? old_size : size);
+    return copy;
+}
+
+static void arena_free(void *ptr, void *user)
+{
+    Arena *arena = user;
+    if (ptr == NULL)
+        return;
+    ArenaBlock *block = (ArenaBlock *)ptr - 1;
+    if (block == arena->last)
+    {
+        arena->current->used -= sizeof(ArenaBlock) + arena_round(block->size);
+        arena->last = NULL;
+    }
+}
+
+static int arena_init(Arena *arena)
+{
+    memset(arena, 0, sizeof(Arena));
+    arena->first = arena->current = new_chunk(ARENA_CHUNK_SIZE);
+    return arena->first ? 0 : -1;
+}
+
+// Everything allocated so far survives arena_reset
+static void arena_set_mark(Arena *arena)
+{
+    arena->mark = arena->current;
+    arena->mark_used = arena->current->used;
+    arena->last = NULL;
+}
+
+// Free everything allocated since the mark, keeping up to ARENA_RETAIN
+// bytes of chunks for the next request
+static void arena_reset(Arena *arena)
+{
+    arena->current = arena->mark;
+    arena->mark->used = arena->mark_used;
+    arena->last = NULL;
+
+    size_t retained = 0;
+    ArenaChunk **link = &arena->mark->next;
+    while (*link)
+    {
+        ArenaChunk *chunk = *link;
+        if (retained + chunk->capacity > ARENA_RETAIN)
+        {
+            *link = chunk->next;
+            free(chunk);
+            continue;
+        }
+        retained += chunk->capacity;
+        chunk->used = 0;
+        link = &chunk->next;
+    }
+}
+
+static void arena_destroy(Arena *arena)
+{
+    ArenaChunk *chunk = arena->first;
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->first = arena->current = arena->mark = NULL;
+}
+
+// Socket helpers
+
+static int make_address(struct sockaddr_un *address, const char *path)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path))
+    {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read up to the first newline into line, which gets NUL-terminated; bytes
+// received after it are moved to rest. Returns the number of those bytes,
+// or -1.
+static ssize_t read_line(int fd, char *line, size_t size, char *rest)
+{
+    size_t len = 0;
+    while (len < size - 1)
+    {
+        ssize_t n = recv(fd, line + len, size - 1 - len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        char *newline = memchr(line + len, '\n', n);
+        len += n;
+        if (newline)
+        {
+            *newline = '\0';
+            size_t extra = line + len - (newline + 1);
+            memcpy(rest, newline + 1, extra);
+            return extra;
+        }
+    }
+    return -1;
+}
+
+static int read_exact(int fd, char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Server
+
+static void send_error(int fd, const char *message)
+{
+    char response[1024];
+    int len = snprintf(response, sizeof(response), "ERROR %s", message);
+    if (len >= (int)sizeof(response))
+        len = sizeof(response) - 1;
+    // Multi-line diagnostics become one response line
+    for (int i = 0; i < len; i++)
+    {
+        if (response[i] == '\n')
+            response[i] = ' ';
+    }
+    response[len++] = '\n';
+    send_all(fd, response, len);
+}
+
+// Same framing as the fd sink
+static int table_header(char *header, size_t size, const char *name)
+{
+    int len = snprintf(header, size, "==> %s.csv <==\n", name);
+    return len >= (int)size ? (int)size - 1 : len;
+}
+
+static int send_tables(int fd, J2RSink *sink)
+{
+    char header[512];
+    size_t total = 0;
+    int count = j2r_sink_table_count(sink);
+    for (int i = 0; i < count; i++)
+    {
+        size_t len = 0;
+        const char *name = j2r_sink_table(sink, i, NULL, &len);
+        if (name == NULL)
+            return -1;
+        total += table_header(header, sizeof(header), name) + len + 1;
+    }
+
+    char status[64];
+    int status_len = snprintf(status, sizeof(status), "OK %zu\n", total);
+    if (send_all(fd, status, status_len) != 0)
+        return -1;
+    for (int i = 0; i < count; i++)
+    {
+        const char *data = NULL;
+        size_t len = 0;
+        const char *name = j2r_sink_table(sink, i, &data, &len);
+        if (name == NULL)
+            return -1;
+        int header_len = table_header(header, sizeof(header), name);
+        if (send_all(fd, header, header_len) != 0 || send_all(fd, data, len) != 0 || send_all(fd, "\n", 1) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int ensure_directory(const char *dir)
+{
+    if (access(dir, F_OK) == 0)
+        return 0;
+    return mkdir(dir, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+static void handle_request(Worker *worker, int fd)
+{
+    char line[REQUEST_LINE_MAX];
+    char rest[REQUEST_LINE_MAX];
+    ssize_t received = read_line(fd, line, sizeof(line), rest);
+    if (received < 0)
+    {
+        send_error(fd, "Error: Malformed request");
+        return;
+    }
+
+    size_t len;
+    int max_depth;
+    int mode_offset = 0;
+    if (sscanf(line, "CONVERT %zu %d %n", &len, &max_depth, &mode_offset) != 2 || mode_offset == 0 ||
+        max_depth < 0 || (size_t)received > len)
+    {
+        send_error(fd, "Error: Malformed request");
+        return;
+    }
+    if (len > worker->max_request)
+    {
+        char message[128];
+        snprintf(message, sizeof(message), "Error: Request of %zu bytes exceeds the limit of %zu", len,
+                 worker->max_request);
+        send_error(fd, message);
+        return;
+    }
+    const char *mode = line + mode_offset;
+    const char *out_dir = NULL;
+    if (strncmp(mode, "dir ", 4) == 0)
+    {
+        out_dir = mode + 4;
+        if (out_dir[0] != '/')
+        {
+            send_error(fd, "Error: Output directory must be an absolute path");
+            return;
+        }
+    }
+    else if (strcmp(mode, "stream") != 0)
+    {
+        send_error(fd, "Error: Unknown output mode");
+        return;
+    }
+
+    if (len > worker->input_capacity)
+    {
+        char *grown = realloc(worker->input, len);
+        if (grown == NULL)
+        {
+            send_error(fd, "Memory allocation failed");
+            return;
+        }
+        worker->input = grown;
+        worker->input_capacity = len;
+    }
+    if (received > 0)
+        memcpy(worker->input, rest, received);
+    if (read_exact(fd, worker->input + received, len - received) != 0)
+    {
+        send_error(fd, "Error: Request shorter than its length");
+        return;
+    }
+
+    j2r_set_max_depth(worker->ctx, max_depth > 0 ? max_depth : DEFAULT_MAX_DEPTH);
+    if (out_dir)
+    {
+        if (ensure_directory(out_dir) != 0)
+        {
+            char message[REQUEST_LINE_MAX + 64];
+            snprintf(message, sizeof(message), "Error: Could not create directory %s", out_dir);
+            send_error(fd, message);
+        }
+        else if (j2r_convert_buffer(worker->ctx, worker->input, len, out_dir) != 0)
+        {
+            send_error(fd, j2r_error(worker->ctx));
+        }
+        else
+        {
+            char status[64];
+            int status_len = snprintf(status, sizeof(status), "OK %zu\n", strlen(out_dir));
+            if (send_all(fd, status, status_len) == 0)
+                send_all(fd, out_dir, strlen(out_dir));
+        }
+    }
+    else
+    {
+        j2r_sink_reset(worker->sink);
+        if (j2r_convert_buffer_to(worker->ctx, worker->input, len, worker->sink) != 0)
+            send_error(fd, j2r_error(worker->ctx));
+        else
+            send_tables(fd, worker->sink);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    struct pollfd fds[2] = {{worker->listen_fd, POLLIN, 0}, {worker->stop_fd, POLLIN, 0}};
+    struct timeval timeout = {REQUEST_TIMEOUT, 0};
+
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[1].revents)
+            break;
+
+        // Another worker may have taken the connection
+        int fd = accept4(worker->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        handle_request(worker, fd);
+        close(fd);
+        worker->requests++;
+
+        // Drop what the conversion allocated and anything oversized
+        arena_reset(&worker->arena);
+        if (worker->input_capacity > ARENA_RETAIN)
+        {
+            free(worker->input);
+            worker->input = NULL;
+            worker->input_capacity = 0;
+        }
+    }
+    return NULL;
+}
+
+static int init_worker(Worker *worker, int listen_fd, int stop_fd, size_t max_request)
+{
+    worker->listen_fd = listen_fd;
+    worker->stop_fd = stop_fd;
+    worker->max_request = max_request;
+    if (arena_init(&worker->arena) != 0)
+        return -1;
+
+    // The context lives below the mark; the sink outlives every request,
+    // so it stays on malloc
+    J2RAllocator allocator = {arena_malloc, arena_realloc, arena_free, &worker->arena};
+    worker->ctx = j2r_context_create(&allocator);
+    arena_set_mark(&worker->arena);
+    worker->sink = create_memory_sink(NULL);
+    return worker->ctx && worker->sink ? 0 : -1;
+}
+
+static void free_worker(Worker *worker)
+{
+    free_sink(worker->sink);
+    arena_destroy(&worker->arena);
+    free(worker->input);
+}
+
+// Bind to path, replacing a socket file no server is listening on
+static int bind_socket(int fd, const struct sockaddr_un *address)
+{
+    if (bind(fd, (const struct sockaddr *)address, sizeof(*address)) == 0)
+        return 0;
+    if (errno != EADDRINUSE)
+        return -1;
+
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    int live = probe >= 0 && connect(probe, (const struct sockaddr *)address, sizeof(*address)) == 0;
+    if (probe >= 0)
+        close(probe);
+    if (live)
+    {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(address->sun_path);
+    return bind(fd, (const struct sockaddr *)address, sizeof(*address));
+}
+
+int run_server(const char *socket_path, int workers, size_t max_request)
+{
+    if (workers <= 0)
+    {
+        workers = DEFAULT_SERVER_WORKERS;
+    }
+    if (max_request == 0)
+    {
+        max_request = DEFAULT_MAX_REQUEST;
+    }
+
+    struct sockaddr_un address;
+    if (make_address(&address, socket_path) != 0)
+        return 1;
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind_socket(listen_fd, &address) != 0 || listen(listen_fd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Error: Could not listen on %s: %s\n", socket_path, strerror(errno));
+        if (listen_fd >= 0)
+            close(listen_fd);
+        return 1;
+    }
+
+    // Workers inherit the blocked signals; only this thread waits for them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int stop[2];
+    Worker *pool = calloc(workers, sizeof(Worker));
+    if (pool == NULL || pipe(stop) != 0)
+    {
+        fprintf(stderr, "Error: Could not start the workers\n");
+        free(pool);
+        close(listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+
+    int started = 0;
+    for (; started < workers; started++)
+    {
+        Worker *worker = &pool[started];
+        if (init_worker(worker, listen_fd, stop[0], max_request) != 0 ||
+            pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+        {
+            fprintf(stderr, "Error: Could not start worker %d\n", started);
+            free_worker(worker);
+            break;
+        }
+    }
+
+    int status = 0;
+    if (started == workers)
+    {
+        fprintf(stderr, "Serving on %s with %d workers\n", socket_path, workers);
+        int signal_number;
+        sigwait(&signals, &signal_number);
+    }
+    else
+    {
+        status = 1;
+    }
+
+    // Workers finish the request they are on, then see the closed pipe
+    close(stop[1]);
+    long requests = 0;
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(pool[i].thread, NULL);
+        requests += pool[i].requests;
+        free_worker(&pool[i]);
+    }
+    close(stop[0]);
+    close(listen_fd);
+    unlink(socket_path);
+    free(pool);
+    fprintf(stderr, "Served %ld requests\n", requests);
+    return status;
+}
+
+// Client
+
+int run_client(const char *socket_path, const char *data, size_t len, const char *out_dir, int max_depth)
+{
+    struct sockaddr_un address;
+    if (make_address(&address, socket_path) != 0)
+        return 1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "Error: Could not connect to %s: %s\n", socket_path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    char line[REQUEST_LINE_MAX];
+    int line_len = out_dir ? snprintf(line, sizeof(line), "CONVERT %zu %d dir %s\n", len, max_depth, out_dir)
+                           : snprintf(line, sizeof(line), "CONVERT %zu %d stream\n", len, max_depth);
+    if (line_len >= (int)sizeof(line))
+    {
+        fprintf(stderr, "Error: Output directory path too long\n");
+        close(fd);
+        return 1;
+    }
+    // A server that rejects the request may close before reading it all,
+    // so a failed send is only reported if no response follows
+    int sent = send_all(fd, line, line_len) == 0 && send_all(fd, data, len) == 0;
+
+    char rest[REQUEST_LINE_MAX];
+    ssize_t received = read_line(fd, line, sizeof(line), rest);
+    size_t body_len;
+    if (received < 0)
+    {
+        fprintf(stderr, "Error: %s\n", sent ? "No response from server" : strerror(errno));
+        close(fd);
+        return 1;
+    }
+    if (strncmp(line, "ERROR ", 6) == 0)
+    {
+        fprintf(stderr, "%s\n", line + 6);
+        close(fd);
+        return 1;
+    }
+    if (sscanf(line, "OK %zu", &body_len) != 1 || (size_t)received > body_len)
+    {
+        fprintf(stderr, "Error: Malformed response from server\n");
+        close(fd);
+        return 1;
+    }
+
+    // Copy the body through as it arrives
+    fwrite(rest, 1, received, stdout);
+    size_t remaining = body_len - received;
+    while (remaining > 0)
+    {
+        ssize_t n = recv(fd, rest, remaining < sizeof(rest) ? remaining : sizeof(rest), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            fprintf(stderr, "Error: Response truncated\n");
+            close(fd);
+            return 1;
+        }
+        fwrite(rest, 1, n, stdout);
+        remaining -= n;
+    }
+    if (out_dir)
+        fputc('\n', stdout);
+    close(fd);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+// Conversion daemon on a Unix domain socket, one request per connection.
+//
+//   request:  CONVERT <length> <max-depth> stream\n<length bytes of JSON>
+//             CONVERT <length> <max-depth> dir <absolute directory>\n<JSON>
+//   response: OK <length>\n<length bytes>
+//             ERROR <message>\n
+//
+// A max-depth of 0 keeps the default. For stream the response body holds
+// every table, each introduced by a line "==> <table>.csv <==" and followed
+// by an empty line; for dir the tables are written to the directory and
+// the body is its path.
+
+// Conversions take turns under the library lock (the scanner and parser
+// are not reentrant), so more workers only overlap socket I/O with them
+#define DEFAULT_SERVER_WORKERS 1
+
+// Largest JSON body a request may announce; longer requests are refused
+// before anything is allocated for them
+#define DEFAULT_MAX_REQUEST ((size_t)256 << 20)
+
+// Serve until SIGINT or SIGTERM, refusing requests longer than max_request
+// bytes (0 for the default); returns the exit status
+int run_server(const char *socket_path, int workers, size_t max_request);
+
+// Send one request and write the response body to stdout (stream) or
+// report the directory (out_dir); returns the exit status
+int run_client(const char *socket_path, const char *data, size_t len, const char *out_dir, int max_depth);
+
+#endif // SERVER_H
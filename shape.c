@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "shape.h"
+#include "schema.h"
+#include "alloc.h"
+
+#define SHAPE_INITIAL_CAPACITY 64
+
+static ShapeTable *create_shape_table(int capacity, ShapeTable *retired)
+{
+    ShapeTable *table = xmalloc(sizeof(ShapeTable));
+    table->capacity = capacity;
+    table->buckets = xcalloc(capacity, sizeof(*table->buckets));
+    table->retired = retired;
+    return table;
+}
+
+ShapeCache *create_shape_cache()
+{
+    ShapeCache *cache = xmalloc(sizeof(ShapeCache));
+    atomic_init(&cache->table, create_shape_table(SHAPE_INITIAL_CAPACITY, NULL));
+    cache->count = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void free_shape_cache(ShapeCache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    // The newest array links every shape exactly once
+    ShapeTable *table = atomic_load(&cache->table);
+    for (int i = 0; i < table->capacity; i++)
+    {
+        for (ShapeLink *link = atomic_load(&table->buckets[i]); link != NULL; link = link->next)
+        {
+            xfree(link->shape->keys);
+            xfree(link->shape->slots);
+            xfree(link->shape->children);
+            xfree(link->shape);
+        }
+    }
+
+    while (table != NULL)
+    {
+        for (int i = 0; i < table->capacity; i++)
+        {
+            ShapeLink *link = atomic_load(&table->buckets[i]);
+            while (link != NULL)
+            {
+                ShapeLink *next = link->next;
+                xfree(link);
+                link = next;
+            }
+        }
+        ShapeTable *retired = table->retired;
+        xfree(table->buckets);
+        xfree(table);
+        table = retired;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    xfree(cache);
+}
+
+// Keys of the object starting at index, in order. Each key entry is
+// followed by its value, which is skipped with the tape's end offsets.
+#define FOR_EACH_KEY(tape, index, i) \
+    for (size_t i = (index) + 1; tape_type(tape, i) == TAPE_KEY; i = tape_next(tape, i + 1))
+
+static unsigned int hash_shape(struct Table *table, const Tape *tape, size_t index)
+{
+    // Keys are atoms, so hashing their addresses is enough
+    uint64_t hash = (uintptr_t)table;
+    FOR_EACH_KEY(tape, index, i)
+    {
+        hash = (hash ^ (uintptr_t)tape_key(tape, i)) * 0x9E3779B97F4A7C15ull;
+    }
+    return (unsigned int)(hash ^ (hash >> 32));
+}
+
+static int shape_matches(Shape *shape, struct Table *table, unsigned int hash, int key_count,
+                         const Tape *tape, size_t index)
+{
+    if (shape->hash != hash || shape->table != table || shape->key_count != key_count)
+        return 0;
+
+    int n = 0;
+    FOR_EACH_KEY(tape, index, i)
+    {
+        if (shape->keys[n++] != tape_key(tape, i))
+            return 0;
+    }
+    return 1;
+}
+
+static Shape *find_shape(ShapeTable *shapes, struct Table *table, unsigned int hash, int key_count,
+                         const Tape *tape, size_t index)
+{
+    ShapeLink *link = atomic_load_explicit(&shapes->buckets[hash & (shapes->capacity - 1)], memory_order_acquire);
+    for (; link != NULL; link = link->next)
+    {
+        if (shape_matches(link->shape, table, hash, key_count, tape, index))
+            return link->shape;
+    }
+    return NULL;
+}
+
+// Publish shape at the head of its bucket; the caller holds the lock
+static void publish_shape(ShapeTable *shapes, Shape *shape)
+{
+    _Atomic(ShapeLink *) *bucket = &shapes->buckets[shape->hash & (shapes->capacity - 1)];
+    ShapeLink *link = xmalloc(sizeof(ShapeLink));
+    link->shape = shape;
+    link->next = atomic_load_explicit(bucket, memory_order_relaxed);
+    atomic_store_explicit(bucket, link, memory_order_release);
+}
+
+// Rehash into a new array twice the size and publish it once it is
+// complete; the caller holds the lock
+static ShapeTable *grow_cache(ShapeCache *cache)
+{
+    ShapeTable *old = atomic_load_explicit(&cache->table, memory_order_relaxed);
+    ShapeTable *shapes = create_shape_table(old->capacity * 2, old);
+    for (int i = 0; i < old->capacity; i++)
+    {
+        ShapeLink *link = atomic_load_explicit(&old->buckets[i], memory_order_relaxed);
+        for (; link != NULL; link = link->next)
+        {
+            publish_shape(shapes, link->shape);
+        }
+    }
+    atomic_store_explicit(&cache->table, shapes, memory_order_release);
+    return shapes;
+}
+
+// Return the shape of the object starting at index of tape, which is being
+// stored in table, resolving its column slots and child tables the first
+// time the key sequence is seen. Hits take no lock.
+Shape *shape_for_object(Schema *schema, Table *table, const Tape *tape, size_t index)
+{
+    if (schema == NULL || table == NULL)
+        return NULL;
+
+    ShapeCache *cache = schema->shapes;
+    int key_count = tape_child_count(tape, index);
+    unsigned int hash = hash_shape(table, tape, index);
+
+    ShapeTable *shapes = atomic_load_explicit(&cache->table, memory_order_acquire);
+    Shape *shape = find_shape(shapes, table, hash, key_count, tape, index);
+    if (shape != NULL)
+        return shape;
+
+    pthread_mutex_lock(&cache->lock);
+    // Another thread may have added it in the meantime
+    shapes = atomic_load_explicit(&cache->table, memory_order_relaxed);
+    shape = find_shape(shapes, table, hash, key_count, tape, index);
+    if (shape != NULL)
+    {
+        pthread_mutex_unlock(&cache->lock);
+        return shape;
+    }
+
+    if (cache->count + 1 > shapes->capacity)
+    {
+        shapes = grow_cache(cache);
+    }
+
+    shape = xmalloc(sizeof(Shape));
+    shape->table = table;
+    shape->hash = hash;
+    shape->key_count = key_count;
+    shape->keys = xmalloc((key_count ? key_count : 1) * sizeof(Atom));
+    shape->slots = xmalloc((key_count ? key_count : 1) * sizeof(int));
+    shape->children = xmalloc((key_count ? key_count : 1) * sizeof(Table *));
+
+    int n = 0;
+    FOR_EACH_KEY(tape, index, i)
+    {
+        Atom key = tape_key(tape, i);
+        shape->keys[n] = key;
+        shape->slots[n] = find_column_slot(table, key);
+        shape->children[n] = find_table(schema, table_name_of(key));
+        n++;
+    }
+
+    publish_shape(shapes, shape);
+    cache->count++;
+    pthread_mutex_unlock(&cache->lock);
+    return shape;
+}
@@ -0,0 +1,60 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "intern.h"
+#include "tape.h"
+
+struct Table;
+struct Schema;
+
+typedef struct Shape Shape;
+typedef struct ShapeCache ShapeCache;
+
+// The shape of an object is the sequence of its (interned) keys. Objects
+// with the same keys in the same order share one Shape, which maps each
+// key position straight to a column slot of the owning table.
+struct Shape
+{
+    struct Table *table;
+    unsigned int hash;
+    int key_count;
+    Atom *keys;
+    int *slots; // Column index per key position, -1 if the key has no column
+    struct Table **children; // Table named after each key, NULL if none
+};
+
+// Entry of a hash bucket. Entries never change once published, so lookups
+// walk them without a lock.
+typedef struct ShapeLink
+{
+    Shape *shape;
+    struct ShapeLink *next;
+} ShapeLink;
+
+// Bucket array of a cache. Growing publishes a new array with links of its
+// own; the old one stays intact for lookups still walking it until the
+// cache is freed.
+typedef struct ShapeTable
+{
+    int capacity;
+    _Atomic(ShapeLink *) *buckets;
+    struct ShapeTable *retired; // The array this one replaced
+} ShapeTable;
+
+// Array elements are populated on several threads. Lookups read the
+// published arrays and links only; the lock serializes inserts.
+struct ShapeCache
+{
+    _Atomic(ShapeTable *) table;
+    int count;
+    pthread_mutex_t lock;
+};
+
+// Shape cache operations
+ShapeCache *create_shape_cache();
+void free_shape_cache(ShapeCache *cache);
+Shape *shape_for_object(struct Schema *schema, struct Table *table, const Tape *tape, size_t index);
+
+#endif // SHAPE_H
@@ -0,0 +1,441 @@
+#define _GNU_SOURCE // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sink.h"
+
+#define SINK_PATH_MAX 4096
+
+typedef struct DirSink
+{
+    Sink base;
+    int fd; // File of the current table
+    char path[SINK_PATH_MAX];
+    char dir[];
+} DirSink;
+
+typedef struct FdSink
+{
+    Sink base;
+    int fd;
+} FdSink;
+
+// Table i of a memory sink: its name, NUL-terminated, at name_offset in
+// data, followed by its CSV
+typedef struct MemoryTable
+{
+    size_t name_offset;
+    size_t offset;
+    size_t len;
+} MemoryTable;
+
+typedef struct MemorySink
+{
+    Sink base;
+    char *data;
+    size_t len;
+    size_t capacity;
+    MemoryTable *tables;
+    int table_count;
+    int table_capacity;
+} MemorySink;
+
+typedef struct CallbackSink
+{
+    Sink base;
+    J2RSinkCallback callback;
+    void *user;
+    const char *table; // Name of the current table
+} CallbackSink;
+
+static void *sink_alloc(const J2RAllocator *allocator, size_t size)
+{
+    return allocator ? allocator->malloc(size, allocator->user) : malloc(size);
+}
+
+static void *sink_realloc(Sink *sink, void *ptr, size_t size)
+{
+    if (!sink->custom_allocator)
+        return realloc(ptr, size);
+    if (ptr == NULL)
+        return sink->allocator.malloc(size, sink->allocator.user);
+    return sink->allocator.realloc(ptr, size, sink->allocator.user);
+}
+
+static void sink_free(Sink *sink, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    if (sink->custom_allocator)
+        sink->allocator.free(ptr, sink->allocator.user);
+    else
+        free(ptr);
+}
+
+static Sink *new_sink(const J2RAllocator *allocator, size_t size)
+{
+    Sink *sink = sink_alloc(allocator, size);
+    if (sink == NULL)
+        return NULL;
+    memset(sink, 0, size);
+    if (allocator)
+    {
+        sink->allocator = *allocator;
+        sink->custom_allocator = 1;
+    }
+    return sink;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Directory sink
+
+static int dir_begin_table(Sink *sink, const char *name)
+{
+    DirSink *dir = (DirSink *)sink;
+    if (snprintf(dir->path, sizeof(dir->path), "%s/%s.csv", dir->dir, name) >= (int)sizeof(dir->path))
+    {
+        fprintf(stderr, "Error: Path too long for table %s\n", name);
+        return -1;
+    }
+
+    // Replace rather than truncate, so a file hard-linked from the
+    // output cache is never written through
+    unlink(dir->path);
+    dir->fd = open(dir->path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (dir->fd < 0)
+    {
+        fprintf(stderr, "Error: Could not open file %s for writing\n", dir->path);
+        return -1;
+    }
+    return 0;
+}
+
+static int dir_write(Sink *sink, const char *data, size_t len)
+{
+    DirSink *dir = (DirSink *)sink;
+    if (write_all(dir->fd, data, len) != 0)
+    {
+        fprintf(stderr, "Error: Could not write file %s: %s\n", dir->path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int dir_end_table(Sink *sink)
+{
+    DirSink *dir = (DirSink *)sink;
+    int status = close(dir->fd);
+    dir->fd = -1;
+    if (status != 0)
+    {
+        fprintf(stderr, "Error: Could not write file %s\n", dir->path);
+        return -1;
+    }
+    return 0;
+}
+
+static void dir_destroy(Sink *sink)
+{
+    DirSink *dir = (DirSink *)sink;
+    if (dir->fd >= 0)
+        close(dir->fd);
+}
+
+Sink *create_dir_sink(const J2RAllocator *allocator, const char *path)
+{
+    DirSink *dir = (DirSink *)new_sink(allocator, sizeof(DirSink) + strlen(path) + 1);
+    if (dir == NULL)
+        return NULL;
+    dir->base.begin_table = dir_begin_table;
+    dir->base.write = dir_write;
+    dir->base.end_table = dir_end_table;
+    dir->base.destroy = dir_destroy;
+    dir->fd = -1;
+    strcpy(dir->dir, path);
+    return &dir->base;
+}
+
+int dir_sink_fd(const Sink *sink)
+{
+    if (sink == NULL || sink->begin_table != dir_begin_table)
+        return -1;
+    return ((const DirSink *)sink)->fd;
+}
+
+// File descriptor sink
+
+static int fd_write(Sink *sink, const char *data, size_t len)
+{
+    if (write_all(((FdSink *)sink)->fd, data, len) != 0)
+    {
+        fprintf(stderr, "Error: Could not write output: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int fd_begin_table(Sink *sink, const char *name)
+{
+    char header[512];
+    int len = snprintf(header, sizeof(header), "==> %s.csv <==\n", name);
+    if (len >= (int)sizeof(header))
+        len = sizeof(header) - 1;
+    return fd_write(sink, header, len);
+}
+
+static int fd_end_table(Sink *sink)
+{
+    return fd_write(sink, "\n", 1);
+}
+
+static void fd_destroy(Sink *sink)
+{
+    (void)sink;
+}
+
+Sink *create_fd_sink(const J2RAllocator *allocator, int fd)
+{
+    FdSink *sink = (FdSink *)new_sink(allocator, sizeof(FdSink));
+    if (sink == NULL)
+        return NULL;
+    sink->base.begin_table = fd_begin_table;
+    sink->base.write = fd_write;
+    sink->base.end_table = fd_end_table;
+    sink->base.destroy = fd_destroy;
+    sink->fd = fd;
+    return &sink->base;
+}
+
+// Memory sink
+
+static int memory_append(MemorySink *memory, const char *data, size_t len)
+{
+    if (memory->capacity - memory->len < len)
+    {
+        size_t capacity = memory->capacity ? memory->capacity : 65536;
+        while (capacity - memory->len < len)
+        {
+            capacity *= 2;
+        }
+        char *grown = sink_realloc(&memory->base, memory->data, capacity);
+        if (grown == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            return -1;
+        }
+        memory->data = grown;
+        memory->capacity = capacity;
+    }
+    memcpy(memory->data + memory->len, data, len);
+    memory->len += len;
+    return 0;
+}
+
+static int memory_begin_table(Sink *sink, const char *name)
+{
+    MemorySink *memory = (MemorySink *)sink;
+    if (memory->table_count == memory->table_capacity)
+    {
+        int capacity = memory->table_capacity ? memory->table_capacity * 2 : 16;
+        MemoryTable *grown = sink_realloc(sink, memory->tables, capacity * sizeof(MemoryTable));
+        if (grown == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            return -1;
+        }
+        memory->tables = grown;
+        memory->table_capacity = capacity;
+    }
+
+    size_t name_offset = memory->len;
+    if (memory_append(memory, name, strlen(name) + 1) != 0)
+        return -1;
+    MemoryTable *table = &memory->tables[memory->table_count++];
+    table->name_offset = name_offset;
+    table->offset = memory->len;
+    table->len = 0;
+    return 0;
+}
+
+static int memory_write(Sink *sink, const char *data, size_t len)
+{
+    MemorySink *memory = (MemorySink *)sink;
+    if (memory_append(memory, data, len) != 0)
+        return -1;
+    memory->tables[memory->table_count - 1].len += len;
+    return 0;
+}
+
+static int memory_end_table(Sink *sink)
+{
+    (void)sink;
+    return 0;
+}
+
+static void memory_destroy(Sink *sink)
+{
+    MemorySink *memory = (MemorySink *)sink;
+    sink_free(sink, memory->data);
+    sink_free(sink, memory->tables);
+}
+
+Sink *create_memory_sink(const J2RAllocator *allocator)
+{
+    MemorySink *sink = (MemorySink *)new_sink(allocator, sizeof(MemorySink));
+    if (sink == NULL)
+        return NULL;
+    sink->base.begin_table = memory_begin_table;
+    sink->base.write = memory_write;
+    sink->base.end_table = memory_end_table;
+    sink->base.destroy = memory_destroy;
+    return &sink->base;
+}
+
+int memory_sink_table_count(const Sink *sink)
+{
+    if (sink == NULL || sink->begin_table != memory_begin_table)
+        return 0;
+    return ((const MemorySink *)sink)->table_count;
+}
+
+const char *memory_sink_table(const Sink *sink, int index, const char **data, size_t *len)
+{
+    if (index < 0 || index >= memory_sink_table_count(sink))
+        return NULL;
+    const MemorySink *memory = (const MemorySink *)sink;
+    const MemoryTable *table = &memory->tables[index];
+    if (data)
+        *data = memory->data + table->offset;
+    if (len)
+        *len = table->len;
+    return memory->data + table->name_offset;
+}
+
+void reset_memory_sink(Sink *sink)
+{
+    if (memory_sink_table_count(sink) == 0)
+        return;
+    MemorySink *memory = (MemorySink *)sink;
+    memory->len = 0;
+    memory->table_count = 0;
+}
+
+// Callback sink
+
+static int callback_begin_table(Sink *sink, const char *name)
+{
+    ((CallbackSink *)sink)->table = name;
+    return 0;
+}
+
+static int callback_write(Sink *sink, const char *data, size_t len)
+{
+    CallbackSink *callback = (CallbackSink *)sink;
+    if (callback->callback(callback->table, data, len, callback->user) != 0)
+    {
+        fprintf(stderr, "Error: Output callback failed for table %s\n", callback->table);
+        return -1;
+    }
+    return 0;
+}
+
+static int callback_end_table(Sink *sink)
+{
+    CallbackSink *callback = (CallbackSink *)sink;
+    int status = callback_write(sink, NULL, 0);
+    callback->table = NULL;
+    return status;
+}
+
+static void callback_destroy(Sink *sink)
+{
+    (void)sink;
+}
+
+Sink *create_callback_sink(const J2RAllocator *allocator, J2RSinkCallback function, void *user)
+{
+    CallbackSink *sink = (CallbackSink *)new_sink(allocator, sizeof(CallbackSink));
+    if (sink == NULL)
+        return NULL;
+    sink->base.begin_table = callback_begin_table;
+    sink->base.write = callback_write;
+    sink->base.end_table = callback_end_table;
+    sink->base.destroy = callback_destroy;
+    sink->callback = function;
+    sink->user = user;
+    return &sink->base;
+}
+
+void free_sink(Sink *sink)
+{
+    if (sink == NULL)
+        return;
+    sink->destroy(sink);
+    sink_free(sink, sink);
+}
+
+// Stream adapter
+
+static ssize_t sink_stream_write(void *cookie, const char *data, size_t len)
+{
+    SinkStream *stream = cookie;
+    if (stream->sink->write(stream->sink, data, len) != 0)
+        return -1;
+    if (stream->bytes)
+        *stream->bytes += len;
+    return len;
+}
+
+FILE *open_sink_stream(SinkStream *stream, Sink *sink, long long *bytes)
+{
+    stream->sink = sink;
+    stream->bytes = bytes;
+    cookie_io_functions_t functions = {NULL, sink_stream_write, NULL, NULL};
+    return fopencookie(stream, "w", functions);
+}
+
+static ssize_t offset_stream_write(void *cookie, const char *data, size_t len)
+{
+    OffsetStream *stream = cookie;
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pwrite(stream->fd, data + done, len - done, stream->offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+        stream->offset += n;
+    }
+    return len;
+}
+
+FILE *open_offset_stream(OffsetStream *stream, int fd, off_t offset)
+{
+    stream->fd = fd;
+    stream->offset = offset;
+    cookie_io_functions_t functions = {NULL, offset_stream_write, NULL, NULL};
+    return fopencookie(stream, "w", functions);
+}
@@ -0,0 +1,68 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "json2relcsv.h"
+
+// Destination of the CSV output, one table at a time: begin_table, any
+// number of writes, end_table. Each returns 0, or -1 after printing why.
+// Sinks never call fatal_error, so a failed write surfaces when the table
+// is finished rather than in the middle of formatting it.
+typedef struct J2RSink Sink;
+
+struct J2RSink
+{
+    int (*begin_table)(Sink *sink, const char *name);
+    int (*write)(Sink *sink, const char *data, size_t len);
+    int (*end_table)(Sink *sink);
+    void (*destroy)(Sink *sink); // Free what the sink owns besides itself
+
+    // Sinks outlive conversions, so their memory comes straight from the
+    // allocator instead of the tracked xmalloc
+    J2RAllocator allocator;
+    int custom_allocator;
+};
+
+// Sink constructors; allocator may be NULL for malloc. They return NULL
+// when out of memory.
+Sink *create_dir_sink(const J2RAllocator *allocator, const char *dir);
+Sink *create_fd_sink(const J2RAllocator *allocator, int fd);
+Sink *create_memory_sink(const J2RAllocator *allocator);
+Sink *create_callback_sink(const J2RAllocator *allocator, J2RSinkCallback callback, void *user);
+void free_sink(Sink *sink);
+
+// File of the current table of a directory sink, -1 for other sinks or
+// outside a table. Writing at offsets of it bypasses write, so the caller
+// counts those bytes itself.
+int dir_sink_fd(const Sink *sink);
+
+// Tables collected by a memory sink
+int memory_sink_table_count(const Sink *sink);
+const char *memory_sink_table(const Sink *sink, int index, const char **data, size_t *len);
+void reset_memory_sink(Sink *sink);
+
+// A stdio stream writing to the current table of a sink, so the CSV
+// formatting code only deals with FILE. stream holds the state and must
+// outlive the FILE. Every byte passed on is added to *bytes; fclose
+// reports a failed write.
+typedef struct SinkStream
+{
+    Sink *sink;
+    long long *bytes;
+} SinkStream;
+
+FILE *open_sink_stream(SinkStream *stream, Sink *sink, long long *bytes);
+
+// A stdio stream writing to fd with pwrite, from offset onwards, so
+// several threads can fill different parts of one file
+typedef struct OffsetStream
+{
+    int fd;
+    off_t offset;
+} OffsetStream;
+
+FILE *open_offset_stream(OffsetStream *stream, int fd, off_t offset);
+
+#endif // SINK_H
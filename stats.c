@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "schema.h"
+#include "perf.h"
+#include "alloc.h"
+
+RunStats run_stats;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "read", "cache", "parse", "schema", "populate", "write"};
+
+const char *phase_name(Phase phase)
+{
+    return phase_names[phase];
+}
+
+static double clock_seconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_begin(Phase phase)
+{
+    PhaseStats *stats = &run_stats.phases[phase];
+    stats->wall_start = clock_seconds(CLOCK_MONOTONIC);
+    stats->cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    perf_phase_begin(phase);
+}
+
+void stats_end(Phase phase)
+{
+    perf_phase_end(phase);
+    PhaseStats *stats = &run_stats.phases[phase];
+    stats->wall += clock_seconds(CLOCK_MONOTONIC) - stats->wall_start;
+    stats->cpu += clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - stats->cpu_start;
+    stats->runs++;
+}
+
+// Remember the row count of every table, since the schema is freed before
+// the stats are printed
+void stats_record_tables(Schema *schema)
+{
+    xfree(run_stats.tables);
+    run_stats.tables = xmalloc((schema->table_count ? schema->table_count : 1) * sizeof(TableStats));
+
+    int n = 0;
+    for (Table *table = schema->tables; table != NULL && n < schema->table_count; table = table->next)
+    {
+        run_stats.tables[n].name = table->name;
+        run_stats.tables[n].rows = table->row_count;
+        n++;
+    }
+    run_stats.table_count = n;
+}
+
+long peak_rss_kb(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss; // Kilobytes on Linux
+}
+
+void print_stats(FILE *out)
+{
+    double total_wall = 0;
+    double total_cpu = 0;
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        total_wall += run_stats.phases[i].wall;
+        total_cpu += run_stats.phases[i].cpu;
+    }
+
+    fprintf(out, "%-10s %12s %12s %7s\n", "phase", "wall ms", "cpu ms", "wall %");
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        PhaseStats *stats = &run_stats.phases[i];
+        if (stats->runs == 0)
+            continue;
+        fprintf(out, "%-10s %12.3f %12.3f %6.1f%%\n", phase_names[i], stats->wall * 1e3, stats->cpu * 1e3,
+                total_wall > 0 ? 100.0 * stats->wall / total_wall : 0.0);
+    }
+    fprintf(out, "%-10s %12.3f %12.3f\n", "total", total_wall * 1e3, total_cpu * 1e3);
+    fprintf(out, "\n");
+
+    fprintf(out, "%-14s %lld\n", "bytes read", run_stats.bytes_read);
+    fprintf(out, "%-14s %lld\n", "bytes written", run_stats.bytes_written);
+    fprintf(out, "%-14s %lld\n", "tokens", run_stats.tokens);
+    fprintf(out, "%-14s %lld\n", "tape entries", run_stats.tape_entries);
+    fprintf(out, "%-14s %ld KB\n", "peak rss", peak_rss_kb());
+    if (run_stats.pipeline.used)
+    {
+        fprintf(out, "%-14s read %lld, parse %lld, format %lld, write %lld\n", "pipeline waits",
+                run_stats.pipeline.read_waits, run_stats.pipeline.parse_waits, run_stats.pipeline.format_waits,
+                run_stats.pipeline.write_waits);
+    }
+
+    if (run_stats.worker_count > 0)
+    {
+        fprintf(out, "\n%-10s %10s %10s %12s\n", "worker", "tasks", "steals", "idle ms");
+        for (int i = 0; i < run_stats.worker_count; i++)
+        {
+            WorkerStats *worker = &run_stats.workers[i];
+            fprintf(out, "%-10d %10lld %10lld %12.3f\n", i, worker->tasks, worker->steals, worker->idle * 1e3);
+        }
+    }
+
+    if (run_stats.table_count > 0)
+    {
+        fprintf(out, "\n%-24s %10s\n", "table", "rows");
+        for (int i = 0; i < run_stats.table_count; i++)
+        {
+            fprintf(out, "%-24s %10d\n", run_stats.tables[i].name, run_stats.tables[i].rows);
+        }
+    }
+}
+
+// Table names only contain letters, digits and underscores, so they need no
+// escaping
+void print_stats_json(FILE *out)
+{
+    fprintf(out, "{\n  \"phases\": {");
+    int first = 1;
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        PhaseStats *stats = &run_stats.phases[i];
+        if (stats->runs == 0)
+            continue;
+        fprintf(out, "%s\n    \"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}", first ? "" : ",",
+                phase_names[i], stats->wall * 1e3, stats->cpu * 1e3);
+        first = 0;
+    }
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"bytes_read\": %lld,\n", run_stats.bytes_read);
+    fprintf(out, "  \"bytes_written\": %lld,\n", run_stats.bytes_written);
+    fprintf(out, "  \"tokens\": %lld,\n", run_stats.tokens);
+    fprintf(out, "  \"tape_entries\": %lld,\n", run_stats.tape_entries);
+    fprintf(out, "  \"peak_rss_kb\": %ld,\n", peak_rss_kb());
+    if (run_stats.pipeline.used)
+    {
+        fprintf(out, "  \"pipeline_waits\": {\"read\": %lld, \"parse\": %lld, \"format\": %lld, \"write\": %lld},\n",
+                run_stats.pipeline.read_waits, run_stats.pipeline.parse_waits, run_stats.pipeline.format_waits,
+                run_stats.pipeline.write_waits);
+    }
+    if (run_stats.worker_count > 0)
+    {
+        fprintf(out, "  \"workers\": [");
+        for (int i = 0; i < run_stats.worker_count; i++)
+        {
+            WorkerStats *worker = &run_stats.workers[i];
+            fprintf(out, "%s\n    {\"tasks\": %lld, \"steals\": %lld, \"idle_ms\": %.3f}", i ? "," : "",
+                    worker->tasks, worker->steals, worker->idle * 1e3);
+        }
+        fprintf(out, "\n  ],\n");
+    }
+    if (perf_counters_available())
+    {
+        fprintf(out, "  \"counters\": ");
+        print_perf_counters_json(out, run_stats.bytes_read);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "  \"tables\": {");
+    for (int i = 0; i < run_stats.table_count; i++)
+    {
+        fprintf(out, "%s\n    \"%s\": %d", i ? "," : "", run_stats.tables[i].name, run_stats.tables[i].rows);
+    }
+    fprintf(out, "%s}\n}\n", run_stats.table_count ? "\n  " : "");
+}
+
+void free_stats(void)
+{
+    xfree(run_stats.tables);
+    run_stats.tables = NULL;
+    run_stats.table_count = 0;
+    xfree(run_stats.workers);
+    run_stats.workers = NULL;
+    run_stats.worker_count = 0;
+}
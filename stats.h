@@ -0,0 +1,85 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "intern.h"
+
+struct Schema;
+
+// Pipeline phases, in the order they run. Lexing is driven by the parser,
+// so the two are timed together.
+typedef enum
+{
+    PHASE_READ,     // Reading stdin for the cache, or mapping a snapshot
+    PHASE_CACHE,    // Output cache lookup and store
+    PHASE_PARSE,    // Lexing and parsing straight into the tape
+    PHASE_SCHEMA,   // generate_schema_from_tape and table plans
+    PHASE_POPULATE, // populate_data_from_tape
+    PHASE_WRITE,    // write_schema_to_csv
+    PHASE_COUNT
+} Phase;
+
+typedef struct PhaseStats
+{
+    double wall;       // Seconds
+    double cpu;        // Seconds of process CPU time
+    double wall_start;
+    double cpu_start;
+    int runs;
+} PhaseStats;
+
+typedef struct TableStats
+{
+    Atom name;
+    int rows;
+} TableStats;
+
+// Times a pipeline stage found its queue empty or full and had to wait:
+// the reader for a free block, the parser for input, the formatter for a
+// free output chunk and the writer for output
+typedef struct PipelineStats
+{
+    int used;
+    long long read_waits;
+    long long parse_waits;
+    long long format_waits;
+    long long write_waits;
+} PipelineStats;
+
+// Work of one thread of the pool: tasks run, tasks stolen from other
+// threads, and seconds spent waiting for tasks
+typedef struct WorkerStats
+{
+    long long tasks;
+    long long steals;
+    double idle;
+} WorkerStats;
+
+typedef struct RunStats
+{
+    PhaseStats phases[PHASE_COUNT];
+    long long bytes_read;
+    long long bytes_written;
+    long long tokens;
+    long long tape_entries; // Built by the parser
+    PipelineStats pipeline;
+    WorkerStats *workers; // Of the last pool, the starting thread first
+    int worker_count;
+    TableStats *tables;
+    int table_count;
+} RunStats;
+
+// Collected on every run, printed with --stats
+extern RunStats run_stats;
+
+// Stats operations
+const char *phase_name(Phase phase);
+void stats_begin(Phase phase);
+void stats_end(Phase phase);
+void stats_record_tables(struct Schema *schema);
+long peak_rss_kb(void);
+void print_stats(FILE *out);
+void print_stats_json(FILE *out);
+void free_stats(void);
+
+#endif // STATS_H
@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tape.h"
+#include "alloc.h"
+#include "fatal.h"
+#include "stats.h"
+
+// Snapshot layout: a fixed header, then the entries, the string buffer and
+// the NUL-separated key names. Sections start on 8-byte boundaries so the
+// entries can be used straight from the mapping.
+#define SNAPSHOT_MAGIC "J2RTAPE"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t entry_count;
+    uint64_t strings_size;
+    uint64_t key_count;
+    uint64_t keys_size;
+    uint64_t reserved[2];
+} SnapshotHeader;
+
+static void* grow(void* items, size_t* capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) return items;
+
+    size_t new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    items = xrealloc(items, new_capacity * item_size);
+    *capacity = new_capacity;
+    return items;
+}
+
+Tape* create_tape() {
+    Tape* tape = xcalloc(1, sizeof(Tape));
+    return tape;
+}
+
+void free_tape(Tape* tape) {
+    if (tape == NULL) return;
+    if (tape->mapping != NULL) {
+        munmap(tape->mapping, tape->mapping_size);
+    } else {
+        xfree(tape->entries);
+        xfree(tape->strings);
+    }
+    xfree(tape->keys);
+    xfree(tape->key_ids);
+    xfree(tape);
+}
+
+double tape_number(const Tape* tape, size_t index) {
+    return strtod(tape_number_text(tape, index), NULL);
+}
+
+// The scanner only accepts valid literals, so the text is a sign and digits
+// unless it has a fraction or exponent. Accumulates negated so INT64_MIN fits.
+int tape_integer(const Tape* tape, size_t index, long long* value) {
+    const char* p = tape_number_text(tape, index);
+    int negative = *p == '-';
+    if (negative) p++;
+    long long number = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        int digit = *p - '0';
+        if (number < (LLONG_MIN + digit) / 10) return 0;
+        number = number * 10 - digit;
+    }
+    if (*p != '\0') return 0;
+    if (!negative) {
+        if (number == LLONG_MIN) return 0;
+        number = -number;
+    }
+    *value = number;
+    return 1;
+}
+
+int tape_count_children(const Tape* tape, size_t index) {
+    int count = 0;
+    size_t end = tape_end(tape, index);
+    for (size_t i = index + 1; i < end; count++) {
+        // Skip the key of a pair, then its value
+        if (tape_type(tape, i) == TAPE_KEY) i++;
+        i = tape_next(tape, i);
+    }
+    return count;
+}
+
+static size_t append_entry(Tape* tape, TapeType type, uint64_t payload) {
+    tape->entries = grow(tape->entries, &tape->capacity, tape->count + 1, sizeof(TapeEntry));
+    tape->entries[tape->count] = ((uint64_t)type << 56) | (payload & TAPE_PAYLOAD_MASK);
+    return tape->count++;
+}
+
+// Copy str into the string buffer and return its offset
+static size_t store_string(Tape* tape, const char* str) {
+    size_t len = strlen(str) + 1;
+    tape->strings = grow(tape->strings, &tape->strings_capacity, tape->strings_size + len, 1);
+    memcpy(tape->strings + tape->strings_size, str, len);
+    tape->strings_size += len;
+    return tape->strings_size - len;
+}
+
+// Keys are numbered per tape so the tape never stores a pointer
+static void append_key(Tape* tape, Atom key) {
+    size_t id = atom_id(key);
+    if (id >= tape->key_ids_capacity) {
+        size_t old_capacity = tape->key_ids_capacity;
+        tape->key_ids = grow(tape->key_ids, &tape->key_ids_capacity, id + 1, sizeof(int));
+        memset(tape->key_ids + old_capacity, 0, (tape->key_ids_capacity - old_capacity) * sizeof(int));
+    }
+
+    if (tape->key_ids[id] == 0) {
+        tape->keys = grow(tape->keys, &tape->key_capacity, tape->key_count + 1, sizeof(Atom));
+        tape->keys[tape->key_count++] = key;
+        tape->key_ids[id] = tape->key_count;
+    }
+    append_entry(tape, TAPE_KEY, tape->key_ids[id] - 1);
+}
+
+// Patch the start entry at start with its end index and child count
+static void close_container(Tape* tape, size_t start, TapeType end_type, int child_count) {
+    size_t end = append_entry(tape, end_type, start);
+    // Start entries have 32 bits for the end index
+    if (end > UINT32_MAX) {
+        fatal_error("Error: Document too large: tape index %zu exceeds %u", end, UINT32_MAX);
+    }
+    uint64_t count = child_count > TAPE_COUNT_MAX ? TAPE_COUNT_MAX : child_count;
+    TapeType start_type = tape_type(tape, start);
+    tape->entries[start] = ((uint64_t)start_type << 56) | (count << 32) | (uint64_t)end;
+}
+
+// Building
+
+typedef struct OpenContainer {
+    size_t start;
+    int child_count;
+} OpenContainer;
+
+// Every value but a key is a child of the innermost open container
+static void count_child(TapeBuilder* builder) {
+    OpenContainer* open = stack_top(&builder->open);
+    if (open != NULL) open->child_count++;
+}
+
+void tape_build_begin(TapeBuilder* builder) {
+    builder->tape = create_tape();
+    builder->open = (TraversalStack){0};
+    stack_reset(&builder->open, sizeof(OpenContainer));
+}
+
+void tape_build_open(TapeBuilder* builder, TapeType start_type) {
+    count_child(builder);
+    OpenContainer* open = stack_push(&builder->open);
+    open->start = append_entry(builder->tape, start_type, 0);
+    open->child_count = 0;
+}
+
+void tape_build_close(TapeBuilder* builder) {
+    OpenContainer* open = stack_top(&builder->open);
+    TapeType start_type = tape_type(builder->tape, open->start);
+    close_container(builder->tape, open->start,
+                    start_type == TAPE_OBJECT_START ? TAPE_OBJECT_END : TAPE_ARRAY_END, open->child_count);
+    stack_pop(&builder->open);
+}
+
+void tape_build_key(TapeBuilder* builder, Atom key) {
+    append_key(builder->tape, key);
+}
+
+void tape_build_string(TapeBuilder* builder, const char* str) {
+    count_child(builder);
+    append_entry(builder->tape, TAPE_STRING, store_string(builder->tape, str));
+}
+
+void tape_build_number(TapeBuilder* builder, const char* text) {
+    count_child(builder);
+    append_entry(builder->tape, TAPE_NUMBER, store_string(builder->tape, text));
+}
+
+void tape_build_literal(TapeBuilder* builder, TapeType type) {
+    count_child(builder);
+    append_entry(builder->tape, type, 0);
+}
+
+Tape* tape_build_end(TapeBuilder* builder) {
+    Tape* tape = builder->tape;
+    builder->tape = NULL;
+    stack_free(&builder->open);
+    run_stats.tape_entries += tape->count;
+
+    // The key index is only needed while building
+    xfree(tape->key_ids);
+    tape->key_ids = NULL;
+    tape->key_ids_capacity = 0;
+    return tape;
+}
+
+// AST
+
+typedef struct TapeFrame {
+    Node* node;
+    union {
+        Pair* pair;
+        Element* elem;
+    } next;
+} TapeFrame;
+
+// Append value, descending into it if it is a container
+static void append_value(TraversalStack* stack, TapeBuilder* builder, Node* value) {
+    switch (value->type) {
+        case NODE_OBJECT:
+        case NODE_ARRAY: {
+            TapeFrame* frame = stack_push(stack);
+            frame->node = value;
+            if (value->type == NODE_OBJECT) {
+                tape_build_open(builder, TAPE_OBJECT_START);
+                frame->next.pair = value->value.pairs;
+            } else {
+                tape_build_open(builder, TAPE_ARRAY_START);
+                frame->next.elem = value->value.elements;
+            }
+            break;
+        }
+        case NODE_STRING:
+            tape_build_string(builder, value->value.str);
+            break;
+        case NODE_NUMBER:
+            tape_build_number(builder, value->value.number);
+            break;
+        case NODE_BOOLEAN:
+            tape_build_literal(builder, value->value.boolean ? TAPE_TRUE : TAPE_FALSE);
+            break;
+        default:
+            tape_build_literal(builder, TAPE_NULL);
+            break;
+    }
+}
+
+// Flatten an AST into a tape, keeping the order of pairs and elements. The
+// parser builds its tape directly; this is for documents built as an AST.
+Tape* tape_from_ast(Node* root) {
+    if (root == NULL) return NULL;
+
+    TapeBuilder builder;
+    tape_build_begin(&builder);
+    TraversalStack stack = {0};
+    stack_reset(&stack, sizeof(TapeFrame));
+    append_value(&stack, &builder, root);
+
+    TapeFrame* frame;
+    while ((frame = stack_top(&stack)) != NULL) {
+        // The push in append_value may move the frame, so advance first
+        if (frame->node->type == NODE_OBJECT && frame->next.pair != NULL) {
+            Pair* pair = frame->next.pair;
+            frame->next.pair = pair->next;
+            tape_build_key(&builder, pair->key);
+            append_value(&stack, &builder, pair->value);
+        } else if (frame->node->type == NODE_ARRAY && frame->next.elem != NULL) {
+            Element* elem = frame->next.elem;
+            frame->next.elem = elem->next;
+            append_value(&stack, &builder, elem->value);
+        } else {
+            tape_build_close(&builder);
+            stack_pop(&stack);
+        }
+    }
+
+    stack_free(&stack);
+    return tape_build_end(&builder);
+}
+
+void print_tape(const Tape* tape) {
+    if (tape == NULL || tape->count == 0) return;
+
+    // Same layout as print_ast_node: keys one level in, their values two
+    typedef struct PrintFrame {
+        size_t end;
+        int indent;
+    } PrintFrame;
+
+    TraversalStack stack = {0};
+    stack_reset(&stack, sizeof(PrintFrame));
+
+    size_t i = 0;
+    int indent = 0;
+    for (;;) {
+        for (int n = 0; n < indent; n++) {
+            printf("  ");
+        }
+
+        switch (tape_type(tape, i)) {
+            case TAPE_OBJECT_START:
+            case TAPE_ARRAY_START: {
+                printf(tape_type(tape, i) == TAPE_OBJECT_START ? "OBJECT\n" : "ARRAY\n");
+                PrintFrame* frame = stack_push(&stack);
+                frame->end = tape_end(tape, i);
+                frame->indent = indent;
+                i++;
+                break;
+            }
+            case TAPE_STRING:
+                printf("STRING: %s\n", tape_string(tape, i));
+                i++;
+                break;
+            case TAPE_NUMBER:
+                printf("NUMBER: %g\n", tape_number(tape, i));
+                i++;
+                break;
+            case TAPE_TRUE:
+            case TAPE_FALSE:
+                printf("BOOLEAN: %s\n", tape_type(tape, i) == TAPE_TRUE ? "true" : "false");
+                i++;
+                break;
+            case TAPE_NULL:
+                printf("NULL\n");
+                i++;
+                break;
+            default:
+                printf("UNKNOWN\n");
+                i++;
+        }
+
+        // Close finished containers, then find where the next value goes
+        PrintFrame* frame;
+        while ((frame = stack_top(&stack)) != NULL && i == frame->end) {
+            stack_pop(&stack);
+            i++;
+        }
+        if (frame == NULL) break;
+
+        if (tape_type(tape, i) == TAPE_KEY) {
+            for (int n = 0; n < frame->indent + 1; n++) {
+                printf("  ");
+            }
+            printf("%s:\n", tape_key(tape, i));
+            indent = frame->indent + 2;
+            i++;
+        } else {
+            indent = frame->indent + 1;
+        }
+    }
+
+    stack_free(&stack);
+}
+
+static int write_all(FILE* file, const void* data, size_t size) {
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+static int write_padding(FILE* file, size_t size) {
+    static const char zeros[8] = {0};
+    size_t pad = (8 - size % 8) % 8;
+    return write_all(file, zeros, pad);
+}
+
+int save_tape(const Tape* tape, const char* path) {
+    if (tape == NULL || path == NULL) return -1;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open snapshot %s for writing\n", path);
+        return -1;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.entry_count = tape->count;
+    header.strings_size = tape->strings_size;
+    header.key_count = tape->key_count;
+    for (int k = 0; k < tape->key_count; k++) {
+        header.keys_size += strlen(tape->keys[k]) + 1;
+    }
+
+    int ok = write_all(file, &header, sizeof(header))
+          && write_all(file, tape->entries, tape->count * sizeof(TapeEntry))
+          && write_all(file, tape->strings, tape->strings_size)
+          && write_padding(file, tape->strings_size);
+    for (int k = 0; ok && k < tape->key_count; k++) {
+        ok = write_all(file, tape->keys[k], strlen(tape->keys[k]) + 1);
+    }
+
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Could not write snapshot %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Check that the tape is well formed: every offset stays inside it,
+// containers nest properly and objects alternate keys and values
+// Container being checked: its start entry and the children seen so far
+typedef struct ValidateFrame {
+    size_t start;
+    size_t child_count;
+} ValidateFrame;
+
+static int validate_tape(const Tape* tape) {
+    TraversalStack stack = {0};
+    stack_reset(&stack, sizeof(ValidateFrame));
+
+    int ok = tape->count > 0;
+    size_t i = 0;
+    while (ok && i < tape->count) {
+        ValidateFrame* open = stack_top(&stack);
+        TapeType type = tape_type(tape, i);
+
+        // The root is a single value; inside an object each value has a key
+        if (open == NULL && i > 0) { ok = 0; break; }
+        if (open != NULL && tape_type(tape, open->start) == TAPE_OBJECT_START && type != TAPE_OBJECT_END) {
+            if (type != TAPE_KEY || tape_payload(tape, i) >= (uint64_t)tape->key_count || ++i >= tape->count) {
+                ok = 0;
+                break;
+            }
+            type = tape_type(tape, i);
+        }
+        if (open != NULL && type != TAPE_OBJECT_END && type != TAPE_ARRAY_END) {
+            open->child_count++;
+        }
+
+        switch (type) {
+            case TAPE_OBJECT_START:
+            case TAPE_ARRAY_START: {
+                if (tape_end(tape, i) <= i || tape_end(tape, i) >= tape->count) ok = 0;
+                ValidateFrame* frame = stack_push(&stack);
+                frame->start = i;
+                frame->child_count = 0;
+                i++;
+                break;
+            }
+            case TAPE_OBJECT_END:
+            case TAPE_ARRAY_END: {
+                // Each end must close the innermost open container of its
+                // kind, whose stored count (saturated) must match. Code that
+                // sizes arrays by the count relies on this.
+                if (open == NULL || tape_end(tape, open->start) != i || tape_payload(tape, i) != open->start
+                    || (type == TAPE_OBJECT_END) != (tape_type(tape, open->start) == TAPE_OBJECT_START)) {
+                    ok = 0;
+                    break;
+                }
+                size_t stored = tape_payload(tape, open->start) >> 32;
+                size_t expected = open->child_count > TAPE_COUNT_MAX ? TAPE_COUNT_MAX : open->child_count;
+                if (stored != expected) ok = 0;
+                stack_pop(&stack);
+                i++;
+                break;
+            }
+            case TAPE_STRING:
+                if (tape_payload(tape, i) >= tape->strings_size) ok = 0;
+                i++;
+                break;
+            case TAPE_NUMBER:
+                if (tape_payload(tape, i) >= tape->strings_size) ok = 0;
+                i++;
+                break;
+            case TAPE_TRUE:
+            case TAPE_FALSE:
+            case TAPE_NULL:
+                i++;
+                break;
+            default:
+                ok = 0;
+        }
+    }
+
+    ok = ok && stack.count == 0;
+    stack_free(&stack);
+    return ok;
+}
+
+Tape* load_tape(const char* path) {
+    if (path == NULL) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open snapshot %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        fprintf(stderr, "Error: %s is not a tape snapshot\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map snapshot %s\n", path);
+        return NULL;
+    }
+
+    const SnapshotHeader* header = (const SnapshotHeader*)data;
+    size_t strings_offset = sizeof(SnapshotHeader) + header->entry_count * sizeof(TapeEntry);
+    size_t keys_offset = strings_offset + header->strings_size + (8 - header->strings_size % 8) % 8;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+        || header->version != SNAPSHOT_VERSION
+        || header->byte_order != SNAPSHOT_BYTE_ORDER
+        || header->entry_count > size / sizeof(TapeEntry)
+        || header->strings_size > size
+        || header->keys_size > size
+        || keys_offset + header->keys_size != size
+        || (header->strings_size > 0 && data[strings_offset + header->strings_size - 1] != '\0')
+        || (header->keys_size > 0 && data[size - 1] != '\0')) {
+        fprintf(stderr, "Error: %s is not a valid tape snapshot\n", path);
+        munmap(data, size);
+        return NULL;
+    }
+
+    Tape* tape = create_tape();
+    tape->mapping = data;
+    tape->mapping_size = size;
+    tape->entries = (TapeEntry*)(data + sizeof(SnapshotHeader));
+    tape->count = header->entry_count;
+    tape->strings = data + strings_offset;
+    tape->strings_size = header->strings_size;
+
+    // Keys are the only part that needs fixing up: intern each name once
+    tape->keys = xmalloc((header->key_count ? header->key_count : 1) * sizeof(Atom));
+    const char* name = data + keys_offset;
+    for (uint64_t k = 0; k < header->key_count; k++) {
+        if (name >= data + size) {
+            fprintf(stderr, "Error: %s is not a valid tape snapshot\n", path);
+            free_tape(tape);
+            return NULL;
+        }
+        tape->keys[k] = intern_string(name);
+        tape->key_count++;
+        name += strlen(name) + 1;
+    }
+    tape->key_capacity = tape->key_count;
+
+    if (!validate_tape(tape)) {
+        fprintf(stderr, "Error: %s is not a valid tape snapshot\n", path);
+        free_tape(tape);
+        return NULL;
+    }
+    return tape;
+}
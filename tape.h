@@ -0,0 +1,142 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ast.h"
+#include "intern.h"
+
+// A parsed document flattened into one contiguous array of 64-bit entries,
+// in document order. The top byte of an entry is its type and the low 56
+// bits its payload:
+//
+//   '{' / '['  index of the matching end entry (low 32 bits) and the
+//              number of pairs or elements (bits 32-55)
+//   '}' / ']'  index of the matching start entry
+//   'k'        key id, an index into Tape::keys
+//   '"'        offset of the string in Tape::strings
+//   'd'        offset of the number's source text in Tape::strings
+//   't' 'f' 'n'  none
+//
+// Objects are stored as alternating key and value entries. Every offset is
+// relative to the tape, so a tape can be written out and mapped back as is.
+typedef uint64_t TapeEntry;
+
+typedef enum {
+    TAPE_OBJECT_START = '{',
+    TAPE_OBJECT_END = '}',
+    TAPE_ARRAY_START = '[',
+    TAPE_ARRAY_END = ']',
+    TAPE_KEY = 'k',
+    TAPE_STRING = '"',
+    TAPE_NUMBER = 'd',
+    TAPE_TRUE = 't',
+    TAPE_FALSE = 'f',
+    TAPE_NULL = 'n'
+} TapeType;
+
+#define TAPE_PAYLOAD_MASK 0x00FFFFFFFFFFFFFFull
+#define TAPE_COUNT_MAX 0xFFFFFF
+
+typedef struct Tape {
+    TapeEntry* entries;
+    size_t count;
+    size_t capacity;
+
+    char* strings;      // NUL-terminated string values
+    size_t strings_size;
+    size_t strings_capacity;
+
+    Atom* keys;         // Distinct keys, indexed by key id
+    int key_count;
+    size_t key_capacity;
+
+    int* key_ids;       // Atom id -> key id + 1 while building, 0 if unseen
+    size_t key_ids_capacity;
+
+    void* mapping;      // Snapshot the entries and strings point into, if loaded
+    size_t mapping_size;
+} Tape;
+
+static inline TapeType tape_type(const Tape* tape, size_t index) {
+    return (TapeType)(tape->entries[index] >> 56);
+}
+
+static inline uint64_t tape_payload(const Tape* tape, size_t index) {
+    return tape->entries[index] & TAPE_PAYLOAD_MASK;
+}
+
+// Index of the end entry matching the start entry at index
+static inline size_t tape_end(const Tape* tape, size_t index) {
+    return (size_t)(tape_payload(tape, index) & 0xFFFFFFFFu);
+}
+
+int tape_count_children(const Tape* tape, size_t index);
+
+// Number of pairs or elements of the container starting at index. Counts
+// too large for the payload are saturated and recounted by walking.
+static inline int tape_child_count(const Tape* tape, size_t index) {
+    int count = (int)(tape_payload(tape, index) >> 32);
+    return count < TAPE_COUNT_MAX ? count : tape_count_children(tape, index);
+}
+
+static inline Atom tape_key(const Tape* tape, size_t index) {
+    return tape->keys[tape_payload(tape, index)];
+}
+
+static inline const char* tape_string(const Tape* tape, size_t index) {
+    return tape->strings + tape_payload(tape, index);
+}
+
+// The number at index, parsed from its text
+double tape_number(const Tape* tape, size_t index);
+
+// The number at index as written in the document
+static inline const char* tape_number_text(const Tape* tape, size_t index) {
+    return tape->strings + tape_payload(tape, index);
+}
+
+// Whether the number at index is written as an integer (no fraction or
+// exponent) that fits in 64 bits; if so it is stored in *value
+int tape_integer(const Tape* tape, size_t index, long long* value);
+
+// Index just past the value starting at index
+static inline size_t tape_next(const Tape* tape, size_t index) {
+    switch (tape_type(tape, index)) {
+        case TAPE_OBJECT_START:
+        case TAPE_ARRAY_START:
+            return tape_end(tape, index) + 1;
+        default:
+            return index + 1;
+    }
+}
+
+// Tape operations
+Tape* create_tape();
+void free_tape(Tape* tape);
+Tape* tape_from_ast(Node* root);
+void print_tape(const Tape* tape);
+
+// Builds a tape in document order, one value at a time, so the parser can
+// emit entries as it reduces without building an AST first. Start entries
+// are patched with their end index and child count when they close.
+typedef struct TapeBuilder {
+    Tape* tape;
+    TraversalStack open;    // Start index and child count of each open container
+} TapeBuilder;
+
+void tape_build_begin(TapeBuilder* builder);
+void tape_build_open(TapeBuilder* builder, TapeType start_type);
+void tape_build_close(TapeBuilder* builder);
+void tape_build_key(TapeBuilder* builder, Atom key);
+void tape_build_string(TapeBuilder* builder, const char* str);
+void tape_build_number(TapeBuilder* builder, const char* text);
+void tape_build_literal(TapeBuilder* builder, TapeType type);   // 't', 'f' or 'n'
+// The finished tape; the builder can begin another
+Tape* tape_build_end(TapeBuilder* builder);
+
+// Snapshots: a tape saved to disk and mapped back without re-parsing
+int save_tape(const Tape* tape, const char* path);
+Tape* load_tape(const char* path);
+
+#endif // TAPE_H
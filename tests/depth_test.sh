@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# Deep nesting test. Converts documents nested exactly as deep as the
+# default --max-depth, with a key or element after a comma at every level
+# so the parser stack holds the most entries per level, and checks that
+# one level more is rejected by the depth limit rather than the parser.
+#
+# Usage: tests/depth_test.sh [BINARY]
+
+BINARY=${1:-./json2relcsv}
+# DEFAULT_MAX_DEPTH in parser.h
+MAX_DEPTH=100000
+
+cd "$(dirname "$0")/.." || exit 1
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ ! -x "$BINARY" ]; then
+    echo "Build first: make" >&2
+    exit 1
+fi
+
+# nest OPEN INNER CLOSE LEVELS: OPEN repeated LEVELS - 1 times around INNER
+nest() {
+    local open=$1 inner=$2 close=$3 levels=$4
+    {
+        printf -- "$open%.0s" $(seq $((levels - 1)))
+        printf '%s' "$inner"
+        printf -- "$close%.0s" $(seq $((levels - 1)))
+        echo
+    }
+}
+
+failed=0
+
+# expect NAME accept|reject FILE
+expect() {
+    local name=$1 outcome=$2 file=$3
+    "$BINARY" --out-dir "$WORK/out" < "$file" > /dev/null 2> "$WORK/err"
+    local status=$?
+    if [ "$outcome" = accept ] && [ $status -ne 0 ]; then
+        echo "$name: FAIL (exit status $status: $(grep -m1 Error "$WORK/err"))"
+        failed=1
+    elif [ "$outcome" = reject ] && { [ $status -eq 0 ] || ! grep -q "nested deeper than" "$WORK/err"; }; then
+        echo "$name: FAIL (exit status $status, not rejected by the depth limit)"
+        failed=1
+    else
+        echo "$name: ok"
+    fi
+    rm -rf "$WORK/out"
+}
+
+nest '{"x":1,"a":' '{"x":1}' '}' $MAX_DEPTH > "$WORK/objects.json"
+expect "Objects $MAX_DEPTH deep" accept "$WORK/objects.json"
+
+# The root object is the first level
+nest '[1,' '[1]' ']' $((MAX_DEPTH - 1)) | sed 's/^/{"a":/; s/$/}/' > "$WORK/arrays.json"
+expect "Arrays $MAX_DEPTH deep" accept "$WORK/arrays.json"
+
+nest '{"x":1,"a":' '{"x":1}' '}' $((MAX_DEPTH + 1)) > "$WORK/too_deep.json"
+expect "Objects $((MAX_DEPTH + 1)) deep" reject "$WORK/too_deep.json"
+
+if [ $failed -ne 0 ]; then
+    echo "Depth test failed"
+    exit 1
+fi
+echo "Depth test passed"
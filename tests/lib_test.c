@@ -0,0 +1,359 @@
+// Tests of the libjson2relcsv API: conversion from a buffer and from a file
+// descriptor, the output sinks, error reporting without exiting, the
+// caller's allocator, no leaks after failures (including every possible
+// allocation failure) and conversions from several threads at once.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "json2relcsv.h"
+
+// Counts live blocks and optionally fails once a budget of allocations is
+// used up
+typedef struct Counter
+{
+    long live;
+    long allocations;
+    long budget; // -1 for unlimited
+} Counter;
+
+static FILE *report;
+static int failures = 0;
+static char work_dir[] = "/tmp/lib_test.XXXXXX";
+
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            fprintf(report, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+static void *counting_malloc(size_t size, void *user)
+{
+    Counter *counter = user;
+    if (counter->budget >= 0 && counter->allocations >= counter->budget)
+        return NULL;
+    void *ptr = malloc(size);
+    if (ptr)
+    {
+        counter->live++;
+        counter->allocations++;
+    }
+    return ptr;
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *user)
+{
+    Counter *counter = user;
+    if (ptr == NULL)
+        return counting_malloc(size, user);
+    if (counter->budget >= 0 && counter->allocations >= counter->budget)
+        return NULL;
+    counter->allocations++;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void *ptr, void *user)
+{
+    Counter *counter = user;
+    if (ptr)
+        counter->live--;
+    free(ptr);
+}
+
+static const char *output_dir(const char *name)
+{
+    static char path[512];
+    snprintf(path, sizeof(path), "%s/%s", work_dir, name);
+    mkdir(path, 0755);
+    return path;
+}
+
+static long file_size(const char *dir, const char *name)
+{
+    char path[1024];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static const char *document = "{\"name\": \"shop\", \"items\": [{\"sku\": 1}, {\"sku\": 2}], "
+                              "\"owner\": {\"first\": \"Ada\"}}";
+
+static void test_buffer(void)
+{
+    Counter counter = {0, 0, -1};
+    J2RAllocator allocator = {counting_malloc, counting_realloc, counting_free, &counter};
+    J2RContext *ctx = j2r_context_create(&allocator);
+    CHECK(ctx != NULL);
+
+    const char *dir = output_dir("buffer");
+    CHECK(j2r_convert_buffer(ctx, document, strlen(document), dir) == 0);
+    CHECK(strcmp(j2r_error(ctx), "") == 0);
+    CHECK(file_size(dir, "root.csv") > 0);
+    CHECK(file_size(dir, "items.csv") > 0);
+    CHECK(file_size(dir, "owner.csv") > 0);
+    CHECK(counter.allocations > 1);
+    CHECK(counter.live == 1); // The context itself
+
+    j2r_context_free(ctx);
+    CHECK(counter.live == 0);
+}
+
+static char *read_file(const char *dir, const char *name, size_t *len)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    char *data = malloc(1 << 20);
+    *len = fread(data, 1, 1 << 20, file);
+    fclose(file);
+    return data;
+}
+
+// Memory and file descriptor sinks hold exactly the bytes of the files
+static void test_memory_and_fd_sinks(void)
+{
+    Counter counter = {0, 0, -1};
+    J2RAllocator allocator = {counting_malloc, counting_realloc, counting_free, &counter};
+    J2RContext *ctx = j2r_context_create(&allocator);
+    const char *dir = output_dir("sinks");
+    CHECK(j2r_convert_buffer(ctx, document, strlen(document), dir) == 0);
+
+    J2RSink *memory = j2r_sink_memory(ctx);
+    CHECK(j2r_convert_buffer_to(ctx, document, strlen(document), memory) == 0);
+    CHECK(j2r_sink_table_count(memory) == 3);
+
+    char fd_path[600];
+    snprintf(fd_path, sizeof(fd_path), "%s/all.txt", dir);
+    int fd = open(fd_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    J2RSink *fd_sink = j2r_sink_fd(ctx, fd);
+    CHECK(j2r_convert_buffer_to(ctx, document, strlen(document), fd_sink) == 0);
+    j2r_sink_free(fd_sink);
+    close(fd);
+
+    size_t all_len;
+    char *all = read_file(dir, "all.txt", &all_len);
+    size_t offset = 0;
+    for (int i = 0; i < j2r_sink_table_count(memory); i++)
+    {
+        const char *data;
+        size_t len, file_len;
+        const char *name = j2r_sink_table(memory, i, &data, &len);
+        char file_name[256], header[300];
+        snprintf(file_name, sizeof(file_name), "%s.csv", name);
+        char *file = read_file(dir, file_name, &file_len);
+        CHECK(file != NULL && file_len == len && memcmp(file, data, len) == 0);
+
+        int header_len = snprintf(header, sizeof(header), "==> %s.csv <==\n", name);
+        CHECK(all != NULL && offset + header_len + len + 1 <= all_len);
+        if (all != NULL && offset + header_len + len + 1 <= all_len)
+        {
+            CHECK(memcmp(all + offset, header, header_len) == 0);
+            CHECK(memcmp(all + offset + header_len, data, len) == 0);
+            CHECK(all[offset + header_len + len] == '\n');
+        }
+        offset += header_len + len + 1;
+        free(file);
+    }
+    CHECK(offset == all_len);
+    CHECK(j2r_sink_table(memory, 3, NULL, NULL) == NULL);
+    free(all);
+
+    // A second conversion adds its tables after the first one's
+    CHECK(j2r_convert_buffer_to(ctx, document, strlen(document), memory) == 0);
+    CHECK(j2r_sink_table_count(memory) == 6);
+    j2r_sink_free(memory);
+    CHECK(counter.live == 1);
+    j2r_context_free(ctx);
+}
+
+typedef struct Collected
+{
+    size_t bytes;
+    int tables_ended;
+    int fail_after; // Fail the call after this many bytes, -1 never
+} Collected;
+
+static int collect(const char *table, const char *data, size_t len, void *user)
+{
+    Collected *collected = user;
+    if (table == NULL)
+        return 1;
+    if (data == NULL)
+    {
+        collected->tables_ended++;
+        return 0;
+    }
+    collected->bytes += len;
+    return collected->fail_after >= 0 && collected->bytes > (size_t)collected->fail_after;
+}
+
+static void test_callback_sink(void)
+{
+    J2RContext *ctx = j2r_context_create(NULL);
+    Collected collected = {0, 0, -1};
+    J2RSink *sink = j2r_sink_callback(ctx, collect, &collected);
+    CHECK(j2r_convert_buffer_to(ctx, document, strlen(document), sink) == 0);
+    CHECK(collected.tables_ended == 3);
+    CHECK(collected.bytes > 0);
+
+    // A callback can stop the conversion
+    Collected failing = {0, 0, 0};
+    J2RSink *failing_sink = j2r_sink_callback(ctx, collect, &failing);
+    CHECK(j2r_convert_buffer_to(ctx, document, strlen(document), failing_sink) == -1);
+    CHECK(strcmp(j2r_error(ctx), "Error: Could not write the tables") == 0);
+
+    j2r_sink_free(sink);
+    j2r_sink_free(failing_sink);
+    j2r_context_free(ctx);
+}
+
+static void test_fd(void)
+{
+    J2RContext *ctx = j2r_context_create(NULL);
+    int fd = open("tests/test3.json", O_RDONLY);
+    CHECK(fd >= 0);
+
+    const char *dir = output_dir("fd");
+    CHECK(j2r_convert_fd(ctx, fd, dir) == 0);
+    CHECK(file_size(dir, "root.csv") > 0);
+    close(fd);
+
+    CHECK(j2r_convert_fd(ctx, -1, dir) == -1);
+    CHECK(strstr(j2r_error(ctx), "Could not read input") != NULL);
+    j2r_context_free(ctx);
+}
+
+static void test_errors(void)
+{
+    Counter counter = {0, 0, -1};
+    J2RAllocator allocator = {counting_malloc, counting_realloc, counting_free, &counter};
+    J2RContext *ctx = j2r_context_create(&allocator);
+    const char *dir = output_dir("errors");
+
+    static const char *bad[] = {"", "{\"a\": [1, 2", "{\"a\": @}", "[1, 2,]", "{\"a\" 1}"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        CHECK(j2r_convert_buffer(ctx, bad[i], strlen(bad[i]), dir) == -1);
+        CHECK(strncmp(j2r_error(ctx), "Error:", 6) == 0);
+        CHECK(counter.live == 1);
+    }
+
+    CHECK(j2r_set_max_depth(ctx, 2) == 0);
+    const char *deep = "{\"a\": {\"b\": {\"c\": 1}}}";
+    CHECK(j2r_convert_buffer(ctx, deep, strlen(deep), dir) == -1);
+    CHECK(strstr(j2r_error(ctx), "nested deeper than 2") != NULL);
+    CHECK(j2r_set_max_depth(ctx, 3) == 0);
+    CHECK(j2r_convert_buffer(ctx, deep, strlen(deep), dir) == 0);
+
+    CHECK(j2r_convert_buffer(ctx, document, strlen(document), "/nonexistent/dir") == -1);
+    CHECK(counter.live == 1);
+
+    // A success after failures starts from a clean scanner and parser
+    CHECK(j2r_convert_buffer(ctx, document, strlen(document), dir) == 0);
+    CHECK(counter.live == 1);
+    j2r_context_free(ctx);
+}
+
+// Fail the first, second, third... allocation of a conversion in turn
+static void test_allocation_failures(void)
+{
+    Counter counter = {0, 0, -1};
+    J2RAllocator allocator = {counting_malloc, counting_realloc, counting_free, &counter};
+    J2RContext *ctx = j2r_context_create(&allocator);
+    const char *dir = output_dir("oom");
+
+    long needed = -1;
+    for (long budget = 0; budget < 10000 && needed < 0; budget++)
+    {
+        counter.allocations = 0;
+        counter.budget = budget;
+        int status = j2r_convert_buffer(ctx, document, strlen(document), dir);
+        if (status == 0)
+            needed = budget;
+        else
+            CHECK(strcmp(j2r_error(ctx), "Memory allocation failed") == 0);
+        CHECK(counter.live == 1);
+    }
+    CHECK(needed > 0);
+
+    counter.budget = -1;
+    j2r_context_free(ctx);
+    CHECK(counter.live == 0);
+}
+
+static void *convert_in_thread(void *arg)
+{
+    const char *dir = arg;
+    J2RContext *ctx = j2r_context_create(NULL);
+    long status = 0;
+    for (int i = 0; i < 20 && status == 0; i++)
+    {
+        status = j2r_convert_buffer(ctx, document, strlen(document), dir);
+    }
+    j2r_context_free(ctx);
+    return (void *)status;
+}
+
+static void test_threads(void)
+{
+    enum { THREADS = 4 };
+    pthread_t threads[THREADS];
+    char paths[THREADS][512];
+    for (int i = 0; i < THREADS; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "thread%d", i);
+        snprintf(paths[i], sizeof(paths[i]), "%s", output_dir(name));
+        pthread_create(&threads[i], NULL, convert_in_thread, paths[i]);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        void *status;
+        pthread_join(threads[i], &status);
+        CHECK(status == NULL);
+        CHECK(file_size(paths[i], "items.csv") > 0);
+    }
+}
+
+int main(void)
+{
+    if (mkdtemp(work_dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    // The converter logs every token and row; keep the report readable
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+
+    test_buffer();
+    test_fd();
+    test_memory_and_fd_sinks();
+    test_callback_sink();
+    test_errors();
+    test_allocation_failures();
+    test_threads();
+
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", work_dir);
+    if (system(command) != 0)
+        fprintf(report, "Could not remove %s\n", work_dir);
+
+    fprintf(report, "%s: %d failure(s)\n", failures ? "FAILED" : "lib_test passed", failures);
+    fclose(report);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+#!/bin/bash
+#
+# Asymptotic scaling test. Converts inputs of size N, 2N, 4N and 8N for
+# several document shapes, fits the growth exponent of time and memory with
+# a least-squares line through log(size) and log(cost), and fails if any
+# exponent is above what N log N allows.
+#
+# Usage: tests/scaling_test.sh [BINARY]
+
+BINARY=${1:-./json2relcsv}
+# n log n grows with exponent 1 + 1/ln(n); allow for timing noise on top
+MAX_EXPONENT=${MAX_EXPONENT:-1.3}
+REPEAT=3
+
+cd "$(dirname "$0")/.." || exit 1
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# One object with n scalar keys, repeated in an array of 20 rows
+gen_wide() {
+    awk -v n="$1" 'BEGIN {
+        printf "{\"rows\": ["
+        for (r = 0; r < 20; r++) {
+            printf "%s{", r ? "," : ""
+            for (k = 0; k < n; k++) printf "%s\"key_%d\": %d", k ? "," : "", k, k
+            printf "}"
+        }
+        print "]}"
+    }'
+}
+
+# One array of n objects
+gen_array() {
+    awk -v n="$1" 'BEGIN {
+        printf "{\"items\": ["
+        for (i = 0; i < n; i++) printf "%s{\"seq\": %d, \"name\": \"item\"}", i ? "," : "", i
+        print "]}"
+    }'
+}
+
+# n nested objects under distinct keys, one table each
+gen_tables() {
+    awk -v n="$1" 'BEGIN {
+        printf "{"
+        for (i = 0; i < n; i++) printf "%s\"table_%d\": {\"value\": %d}", i ? "," : "", i, i
+        print "}"
+    }'
+}
+
+# Objects nested n levels deep
+gen_deep() {
+    awk -v n="$1" 'BEGIN {
+        printf "{"
+        for (i = 0; i < n; i++) printf "\"child\": {\"level\": %d, ", i
+        printf "\"leaf\": true"
+        for (i = 0; i <= n; i++) printf "}"
+        print ""
+    }'
+}
+
+# Best wall time in seconds and peak RSS in KB of converting one file
+measure() {
+    local input=$1 best="" rss=0
+    for _ in $(seq $REPEAT); do
+        rm -rf "$WORK/out"
+        local start end
+        start=$(date +%s%N)
+        "$BINARY" --out-dir "$WORK/out" --stats-json "$WORK/stats.json" < "$input" > /dev/null 2>&1 || return 1
+        end=$(date +%s%N)
+        local t=$((end - start))
+        if [ -z "$best" ] || [ $t -lt "$best" ]; then best=$t; fi
+        rss=$(awk -F': ' '/"peak_rss_kb"/ { gsub(/,/, "", $2); print $2 }' "$WORK/stats.json")
+    done
+    echo "$(awk -v t="$best" 'BEGIN { print t / 1e9 }') $rss"
+}
+
+# Slope of the least-squares fit of log(y) against log(x), one "x y" per line
+fit_exponent() {
+    awk '$2 > 0 {
+        x = log($1); y = log($2); n++
+        sx += x; sy += y; sxx += x * x; sxy += x * y
+    }
+    END {
+        if (n < 2) { print "nan"; exit }
+        printf "%.2f\n", (n * sxy - sx * sy) / (n * sxx - sx * sx)
+    }'
+}
+
+if [ ! -x "$BINARY" ]; then
+    echo "Build first: make" >&2
+    exit 1
+fi
+
+# Memory of an almost empty conversion, subtracted so fixed overhead does
+# not flatten the memory exponent
+echo '{"a": 1}' > "$WORK/empty.json"
+read -r _ base_rss < <(measure "$WORK/empty.json")
+
+failed=0
+printf "%-8s %8s %10s %10s\n" "shape" "size" "seconds" "RSS KB"
+for spec in "wide 250" "array 5000" "tables 500" "deep 2000"; do
+    read -r shape n <<< "$spec"
+    : > "$WORK/time"
+    : > "$WORK/mem"
+    for scale in 1 2 4 8; do
+        size=$((n * scale))
+        "gen_$shape" $size > "$WORK/input.json"
+        if ! read -r seconds rss < <(measure "$WORK/input.json"); then
+            echo "$shape: conversion of size $size failed" >&2
+            failed=1
+            continue 2
+        fi
+        printf "%-8s %8d %10.3f %10d\n" "$shape" $size "$seconds" "$rss"
+        echo "$size $seconds" >> "$WORK/time"
+        echo "$size $((rss - base_rss))" >> "$WORK/mem"
+    done
+
+    time_exp=$(fit_exponent < "$WORK/time")
+    mem_exp=$(fit_exponent < "$WORK/mem")
+    status=ok
+    if awk -v t="$time_exp" -v m="$mem_exp" -v max="$MAX_EXPONENT" 'BEGIN { exit !(t > max || m > max) }'; then
+        status=FAIL
+        failed=1
+    fi
+    printf "%-8s time exponent %s, memory exponent %s: %s\n\n" "$shape" "$time_exp" "$mem_exp" "$status"
+done
+
+if [ $failed -ne 0 ]; then
+    echo "Scaling test failed: growth faster than N log N (exponent above $MAX_EXPONENT)"
+    exit 1
+fi
+echo "Scaling test passed"
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Snapshot validation test. Saves a snapshot with --save-ast, checks that
+# it loads back to the same tables, then corrupts the child count of the
+# root object and checks that --load-ast rejects the file instead of
+# converting it.
+#
+# Usage: tests/snapshot_test.sh [BINARY]
+
+BINARY=${1:-./json2relcsv}
+# The header is 64 bytes; bits 32-55 of the root entry hold its count
+COUNT_OFFSET=68
+
+cd "$(dirname "$0")/.." || exit 1
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ ! -x "$BINARY" ]; then
+    echo "Build first: make" >&2
+    exit 1
+fi
+
+failed=0
+"$BINARY" --out-dir "$WORK/parsed" --save-ast "$WORK/doc.tape" < tests/test2.json > /dev/null 2>&1 || {
+    echo "Could not save a snapshot of tests/test2.json"
+    exit 1
+}
+
+if ! "$BINARY" --load-ast "$WORK/doc.tape" --out-dir "$WORK/loaded" > /dev/null 2>&1 ||
+    ! diff -r "$WORK/parsed" "$WORK/loaded" > /dev/null; then
+    echo "Intact snapshot: FAIL (did not load to the same tables)"
+    failed=1
+else
+    echo "Intact snapshot: ok"
+fi
+
+# Raise the stored count by one; the entries still nest correctly
+count=$(od -An -tu1 -j $COUNT_OFFSET -N1 "$WORK/doc.tape" | tr -d ' ')
+printf "$(printf '\\%03o' $(((count + 1) % 256)))" |
+    dd of="$WORK/doc.tape" bs=1 seek=$COUNT_OFFSET conv=notrunc 2> /dev/null
+"$BINARY" --load-ast "$WORK/doc.tape" --out-dir "$WORK/corrupt" > /dev/null 2> "$WORK/corrupt.err"
+status=$?
+if [ $status -eq 0 ] || ! grep -q "not a valid tape snapshot" "$WORK/corrupt.err"; then
+    echo "Corrupt child count: FAIL (exit status $status)"
+    failed=1
+else
+    echo "Corrupt child count: ok"
+fi
+
+if [ $failed -ne 0 ]; then
+    echo "Snapshot test failed"
+    exit 1
+fi
+echo "Snapshot test passed"